@@ -0,0 +1,313 @@
+// async.h
+// Coroutine tasks on a ThreadPool, needs C++20
+
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "async.h needs C++20 coroutines"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "threadpool.h"
+#include "ppm.h"
+
+/*
+ A coroutine that returns a T. It is lazy: it starts when it is awaited and resumes its
+ awaiter when it is done, on the thread it finished on, so a chain of awaits costs neither
+ a thread nor a blocked worker. Exceptions reach the awaiter. A task is awaited once.
+ */
+template<class T = void> class task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    // Resumes the awaiter straight from the finished coroutine, without growing the stack
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template<class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> done) noexcept { return done.promise().continuation; }
+        void await_resume() noexcept { }
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<class T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    task<T> get_return_object();
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T result()
+    {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template<>
+struct Promise<void> : PromiseBase {
+    task<void> get_return_object();
+    void return_void() { }
+    void result()
+    {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+} // namespace detail
+
+template<class T>
+class task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    task(task &&other) noexcept: handle(std::exchange(other.handle, nullptr)) { }
+    task &operator=(task other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    ~task() { if (handle) handle.destroy(); }
+
+    bool await_ready() const noexcept { return handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+
+    // Awaits the end of the task without taking its result, which co_await of the task still gives
+    struct Ready {
+        std::coroutine_handle<promise_type> handle;
+        bool await_ready() const noexcept { return handle.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+        void await_resume() noexcept { }
+    };
+    Ready ready() const noexcept { return Ready{ handle }; }
+private:
+    friend promise_type;
+    explicit task(std::coroutine_handle<promise_type> h): handle(h) { }
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<class T>
+task<T> detail::Promise<T>::get_return_object()
+{
+    return task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline task<void> detail::Promise<void>::get_return_object()
+{
+    return task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+/*
+ co_await schedule(pool) goes on as a task of pool, from wherever the coroutine was. It throws
+ once the pool is shut down; a task the pool drops while shutting down never resumes.
+ */
+struct ScheduleAwaiter {
+    ThreadPool &pool;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) { pool.enqueue([h]() { h.resume(); }); }
+    void await_resume() const noexcept { }
+};
+
+inline ScheduleAwaiter schedule(ThreadPool &pool) { return ScheduleAwaiter{ pool }; }
+
+// t, started as a task of pool
+template<class T>
+task<T> on(ThreadPool &pool, task<T> t)
+{
+    co_await schedule(pool);
+    co_return co_await std::move(t);
+}
+
+namespace detail {
+
+// Counts the tasks of a when_all down, the last one to finish resumes the awaiter
+struct Join {
+    std::atomic<size_t> remaining;
+    std::coroutine_handle<> parent;
+};
+
+struct JoinTask {
+    struct promise_type {
+        Join *join = nullptr;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> done) noexcept
+            {
+                Join *join = done.promise().join;
+                if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    return join->parent;
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept { }
+        };
+
+        JoinTask get_return_object() { return JoinTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); } // Ready never throws
+    };
+
+    explicit JoinTask(std::coroutine_handle<promise_type> h): handle(h) { }
+    JoinTask(JoinTask &&other) noexcept: handle(std::exchange(other.handle, nullptr)) { }
+    ~JoinTask() { if (handle) handle.destroy(); }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template<class T>
+JoinTask join(task<T> &t)
+{
+    co_await t.ready();
+}
+
+// Starts every JoinTask and suspends the awaiter until the last is done, unless they all already are
+struct JoinAll {
+    std::vector<JoinTask> &tasks;
+    Join &join;
+
+    bool await_ready() const noexcept { return tasks.empty(); }
+    bool await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        join.parent = awaiting;
+        for (JoinTask &t : tasks) {
+            t.handle.promise().join = &join;
+            t.handle.resume();
+        }
+        // One count for the awaiter itself, so no task resumes it before all have started
+        return join.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+    void await_resume() noexcept { }
+};
+
+template<class T>
+task<void> join_all(std::vector<task<T>> &tasks)
+{
+    Join join;
+    join.remaining.store(tasks.size() + 1, std::memory_order_relaxed);
+    std::vector<JoinTask> joins;
+    for (task<T> &t : tasks)
+        joins.push_back(detail::join(t));
+    co_await JoinAll{ joins, join };
+}
+
+} // namespace detail
+
+/*
+ Runs tasks together and gives their results in order once all are done. They start one after
+ the other on the awaiting thread and run in parallel from their first co_await schedule() on,
+ so to fan out every task goes to the pool first, with on() or a schedule() of its own. The
+ first exception in order is thrown, after every task has finished.
+ */
+template<class T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks)
+{
+    co_await detail::join_all(tasks);
+    std::vector<T> results;
+    results.reserve(tasks.size());
+    for (task<T> &t : tasks)
+        results.push_back(co_await t);
+    co_return results;
+}
+
+inline task<void> when_all(std::vector<task<void>> tasks)
+{
+    co_await detail::join_all(tasks);
+    for (task<void> &t : tasks)
+        co_await t;
+}
+
+/*
+ Blocks the calling thread until t is done and gives its result, to get from plain code into
+ coroutines. Not from a worker of a pool that t needs, that worker would wait on itself.
+ */
+template<class T>
+T sync_wait(task<T> t)
+{
+    struct Event {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool set = false;
+    } event;
+    struct Signal {
+        struct promise_type {
+            Event *event = nullptr;
+            struct FinalAwaiter {
+                bool await_ready() noexcept { return false; }
+                void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    Event &e = *h.promise().event;
+                    std::lock_guard<std::mutex> lock(e.mutex);
+                    e.set = true;
+                    e.done.notify_all();
+                }
+                void await_resume() noexcept { }
+            };
+            Signal get_return_object() { return Signal{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            FinalAwaiter final_suspend() noexcept { return {}; }
+            void return_void() { }
+            void unhandled_exception() { std::terminate(); }
+        };
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    auto wait = [](task<T> &t) -> Signal { co_await t.ready(); };
+    Signal signal = wait(t);
+    signal.handle.promise().event = &event;
+    signal.handle.resume();
+    {
+        std::unique_lock<std::mutex> lock(event.mutex);
+        event.done.wait(lock, [&]() { return event.set; });
+    }
+    signal.handle.destroy();
+    return t.await_resume();
+}
+
+/*
+ Writes image to filename as a task of io, a pool for blocking file writes, and goes on on
+ resume: the workers of resume keep computing while the file is written. A file that cannot
+ be written throws std::runtime_error.
+ */
+inline task<void> saveAsync(const PPMImage &image, std::string filename, ThreadPool &io, ThreadPool &resume)
+{
+    co_await schedule(io);
+    std::exception_ptr error;
+    {
+        std::ofstream out(filename, std::ios_base::binary);
+        out << PPMImage::header(image.width(), image.height());
+        image.writeRows(out, 0, image.height());
+        if (!out)
+            error = std::make_exception_ptr(std::runtime_error("cannot write " + filename));
+    }
+    co_await schedule(resume);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+#endif // ASYNC_H
@@ -0,0 +1,261 @@
+// bench.cpp
+// Wall clock timings of every subsystem over a range of thread counts and problem sizes
+// Compile with:
+// g++ -std=c++11 -O2 -pthread bench.cpp render.cpp deepzoom.cpp nodes.cpp ttt.cpp topology.cpp parallel.cpp
+//     timing.cpp -o bench
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "threadpool.h"
+#include "topology.h"
+#include "parallel.h"
+#include "timing.h"
+#include "mandelbrot.h"
+#include "dotproduct.h"
+#include "tree.h"
+#include "ttt_mc.h"
+
+// One kernel at one problem size: run does the work once and returns how many units it did
+struct Benchmark {
+    std::string kernel;
+    std::string size;
+    const char *unit;
+    std::function<double(ThreadPool &pool, unsigned threads)> run;
+};
+
+struct Result {
+    std::string kernel, size;
+    const char *unit;
+    unsigned threads;
+    double median, best; // seconds
+    double rate;         // units per second at the median
+    double speedup;      // over the first thread count
+    size_t order;        // of the benchmark, to list its thread counts together
+};
+
+static std::vector<Benchmark> benchmarks(bool quick)
+{
+    std::vector<Benchmark> list;
+
+    // Mandelbrot tiles with the default kernel and palette, without writing the picture
+    const int widths[] = { 400, 1600 };
+    for (int width : widths) {
+        if (quick && width > 400) continue;
+        const int height = width * 13 / 16;
+        std::ostringstream size;
+        size << width << "x" << height;
+        list.push_back({ "render", size.str(), "pixels", [width, height](ThreadPool &pool, unsigned) {
+            RenderJob job = defaultJob();
+            job.width = width;
+            job.height = height;
+            const Palette palette(job.palette->coloring, job.maxIterations, job.palette->steps);
+            const Frame frame = { job, palette };
+            PPMImage image(height, width);
+            renderTiles(frame, image, pool);
+            return double(width) * height;
+        } });
+    }
+
+    // DotProduct of int vectors, one partition per thread
+    const struct { const char *name; Accumulation accumulation; } modes[] = {
+        { "dot-mutex", Accumulation::Mutex },
+        { "dot-atomic", Accumulation::Atomic },
+        { "dot-reduction", Accumulation::Reduction },
+    };
+    const size_t lengths[] = { 1000000, 10000000 };
+    for (size_t length : lengths) {
+        if (quick && length > 1000000) continue;
+        std::shared_ptr<std::vector<int32_t>> a = std::make_shared<std::vector<int32_t>>(length, 1);
+        std::shared_ptr<std::vector<int32_t>> b = std::make_shared<std::vector<int32_t>>(length, 2);
+        for (const auto &m : modes) {
+            Accumulation accumulation = m.accumulation;
+            list.push_back({ m.name, std::to_string(length), "elements", [a, b, accumulation](ThreadPool &pool, unsigned threads) {
+                DotProduct<int32_t> dp(pool, *a, *b, accumulation, threads);
+                if (dp() != 2 * int64_t(a->size()))
+                    std::cerr << "wrong dot product" << std::endl;
+                return double(a->size());
+            } });
+        }
+    }
+
+    // The same dot product through parallel_reduce, in pieces of 64K elements
+    for (size_t length : lengths) {
+        if (quick && length > 1000000) continue;
+        std::shared_ptr<std::vector<int32_t>> a = std::make_shared<std::vector<int32_t>>(length, 1);
+        std::shared_ptr<std::vector<int32_t>> b = std::make_shared<std::vector<int32_t>>(length, 2);
+        list.push_back({ "dot-parallel", std::to_string(length), "elements", [a, b](ThreadPool &pool, unsigned) {
+            int64_t dot = parallel_reduce(pool, Range{ 0, a->size() }, 1 << 16, int64_t(0),
+                [&](size_t begin, size_t end) { return dotRange(a->data() + begin, b->data() + begin, end - begin, Summation::Plain); },
+                [](int64_t x, int64_t y) { return x + y; });
+            if (dot != 2 * int64_t(a->size()))
+                std::cerr << "wrong dot product" << std::endl;
+            return double(a->size());
+        } });
+    }
+
+    // Parallel evaluation of a balanced Tree, built once
+    const int depths[] = { 14, 18 };
+    for (int depth : depths) {
+        if (quick && depth > 14) continue;
+        std::shared_ptr<Tree> tree = std::make_shared<Tree>(balanced(depth));
+        list.push_back({ "tree", std::to_string(tree->size()), "nodes", [tree](ThreadPool &pool, unsigned) {
+            valtab['A'] = 3; valtab['B'] = 4;
+            tree->eval(pool, 10000);
+            return double(tree->size());
+        } });
+    }
+
+    // Empty tasks through the pool, the overhead of a task
+    const int counts[] = { 10000, 100000 };
+    for (int count : counts) {
+        if (quick && count > 10000) continue;
+        list.push_back({ "pool", std::to_string(count), "tasks", [count](ThreadPool &pool, unsigned) {
+            TaskGroup group(pool);
+            for (int i = 0; i < count; i++)
+                group.submit([]() { });
+            group.wait();
+            return double(count);
+        } });
+    }
+
+    // Random tic-tac-toe playouts from the empty board, split over one task per thread
+    const int playouts[] = { 100000, 1000000 };
+    for (int count : playouts) {
+        if (quick && count > 100000) continue;
+        list.push_back({ "playouts", std::to_string(count), "playouts", [count](ThreadPool &pool, unsigned threads) {
+            TaskGroup group(pool);
+            std::vector<int> wins(threads * 16); // a cache line per task
+            for (unsigned t = 0; t < threads; t++) {
+                group.submit([&, t]() {
+                    Xoshiro128 rng(t);
+                    Board empty = { 0, 0, Player::X };
+                    for (int i = t; i < count; i += threads)
+                        wins[t * 16] += getWinner(playout(empty, rng)) == Player::X;
+                });
+            }
+            group.wait();
+            return double(count);
+        } });
+    }
+    return list;
+}
+
+static std::vector<unsigned> parseThreads(const std::string &list)
+{
+    std::vector<unsigned> threads;
+    std::istringstream in(list);
+    for (std::string item; std::getline(in, item, ','); )
+        if (std::atoi(item.c_str()) > 0)
+            threads.push_back(std::atoi(item.c_str()));
+    return threads;
+}
+
+static void usage()
+{
+    std::cerr << "usage: bench [options]\n"
+                 "  --threads LIST     comma separated thread counts (1,2,4,... up to CONCURRENT_THREADS or the CPUs)\n"
+                 "  --repetitions N    timed runs per measurement, the median is reported (5)\n"
+                 "  --warmup N         untimed runs before them (1)\n"
+                 "  --only NAME        only kernels whose name starts with NAME\n"
+                 "  --quick            only the smaller problem sizes\n"
+                 "  --json             JSON instead of a table\n";
+}
+
+int main(int argc, char *argv[])
+{
+    const unsigned hardware = unsigned(poolConfig().threads);
+    std::vector<unsigned> threads;
+    for (unsigned t = 1; t < hardware; t *= 2)
+        threads.push_back(t);
+    threads.push_back(hardware);
+    int repetitions = 5, warmup = 1;
+    std::string only;
+    bool quick = false, json = false;
+
+    for (int a = 1; a < argc; a++) {
+        const std::string option = argv[a];
+        const bool hasValue = option == "--threads" || option == "--repetitions" || option == "--warmup" ||
+                              option == "--only";
+        if (hasValue && a + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        if (option == "--threads")
+            threads = parseThreads(argv[++a]);
+        else if (option == "--repetitions")
+            repetitions = std::atoi(argv[++a]);
+        else if (option == "--warmup")
+            warmup = std::atoi(argv[++a]);
+        else if (option == "--only")
+            only = argv[++a];
+        else if (option == "--quick")
+            quick = true;
+        else if (option == "--json")
+            json = true;
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (threads.empty() || repetitions <= 0 || warmup < 0) {
+        usage();
+        return 1;
+    }
+
+    std::vector<Benchmark> list;
+    for (const Benchmark &b : benchmarks(quick))
+        if (b.kernel.compare(0, only.size(), only) == 0)
+            list.push_back(b);
+
+    // One pool per thread count, every benchmark runs on it
+    std::vector<Result> results;
+    for (unsigned t : threads) {
+        ThreadPool pool(t, ThreadPool::Mode::WorkStealing);
+        applyPinning(pool, poolConfig().pinning);
+        for (size_t k = 0; k < list.size(); k++) {
+            const Benchmark &b = list[k];
+            double units = 0;
+            std::vector<double> seconds = timeRuns([&]() { return b.run(pool, t); }, warmup, repetitions, units);
+            Result r = { b.kernel, b.size, b.unit, t, median(seconds), seconds[0], 0, 1, k };
+            r.rate = units / r.median;
+            results.push_back(r);
+            if (!json)
+                std::cerr << b.kernel << " " << b.size << " on " << t << " threads" << std::endl;
+        }
+    }
+    std::stable_sort(results.begin(), results.end(), [](const Result &x, const Result &y) { return x.order < y.order; });
+    for (Result &r : results)
+        for (const Result &first : results)
+            if (first.kernel == r.kernel && first.size == r.size) {
+                r.speedup = first.median / r.median;
+                break;
+            }
+
+    if (json) {
+        std::printf("{\"hardware_threads\": %u, \"repetitions\": %d, \"warmup\": %d, \"results\": [", hardware,
+                    repetitions, warmup);
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result &r = results[i];
+            std::printf("%s\n  {\"kernel\": \"%s\", \"size\": \"%s\", \"threads\": %u, \"median_s\": %.6g, "
+                        "\"min_s\": %.6g, \"%s_per_s\": %.6g, \"speedup\": %.3f}",
+                        i ? "," : "", r.kernel.c_str(), r.size.c_str(), r.threads, r.median, r.best, r.unit,
+                        r.rate, r.speedup);
+        }
+        std::printf("\n]}\n");
+    }
+    else {
+        std::printf("%-14s %-10s %7s %12s %12s %14s %-9s %7s\n", "kernel", "size", "threads", "median s",
+                    "min s", "rate /s", "unit", "speedup");
+        for (const Result &r : results)
+            std::printf("%-14s %-10s %7u %12.6f %12.6f %14.4g %-9s %7.2f\n", r.kernel.c_str(), r.size.c_str(),
+                        r.threads, r.median, r.best, r.rate, r.unit, r.speedup);
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+// cpu_features.h
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1
+#else
+#define HAVE_X86_SIMD 0
+#endif
+
+// Instruction set extensions the running CPU supports, detected once
+struct CpuFeatures {
+    bool sse2;
+    bool avx2;
+    bool fma;
+    bool avx512f;
+};
+
+inline const CpuFeatures &cpuFeatures()
+{
+    static const CpuFeatures features = []() {
+        CpuFeatures f = { false, false, false, false };
+#if HAVE_X86_SIMD
+        __builtin_cpu_init();
+        f.sse2 = __builtin_cpu_supports("sse2");
+        f.avx2 = __builtin_cpu_supports("avx2");
+        f.fma = __builtin_cpu_supports("fma");
+        f.avx512f = __builtin_cpu_supports("avx512f");
+#endif
+        return f;
+    }();
+    return features;
+}
+
+#endif // CPU_FEATURES_H
@@ -0,0 +1,331 @@
+// deepzoom.cpp
+// Perturbation theory renderer for zooms beyond the precision of doubles
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <stdexcept>
+#include "deepzoom.h"
+#include "parallel.h"
+
+BigFixed BigFixed::parse(const std::string &text, size_t fractionLimbs)
+{
+    size_t pos = 0;
+    bool negative = false;
+    if (pos < text.size() && (text[pos] == '-' || text[pos] == '+'))
+        negative = text[pos++] == '-';
+
+    uint64_t integer = 0;
+    size_t digits = 0;
+    for (; pos < text.size() && std::isdigit((unsigned char)text[pos]); pos++, digits++)
+    {
+        integer = integer * 10 + (text[pos] - '0');
+        if (integer > 0xffffffffu)
+            throw std::invalid_argument("number out of range: " + text);
+    }
+    std::string fraction;
+    if (pos < text.size() && text[pos] == '.')
+        for (pos++; pos < text.size() && std::isdigit((unsigned char)text[pos]); pos++)
+            fraction += text[pos];
+    if (pos != text.size() || digits + fraction.size() == 0)
+        throw std::invalid_argument("not a decimal number: " + text);
+
+    // Horner from the last digit: f = (f + d) / 10
+    BigFixed result(fractionLimbs);
+    for (size_t k = fraction.size(); k-- > 0; )
+    {
+        result._limbs.back() += fraction[k] - '0';
+        uint64_t remainder = 0;
+        for (size_t i = result._limbs.size(); i-- > 0; )
+        {
+            uint64_t current = (remainder << 32) | result._limbs[i];
+            result._limbs[i] = uint32_t(current / 10);
+            remainder = current % 10;
+        }
+    }
+    result._limbs.back() = uint32_t(integer);
+    result._negative = negative;
+    return result;
+}
+
+BigFixed BigFixed::fromDouble(double value, size_t fractionLimbs)
+{
+    BigFixed result(fractionLimbs);
+    double x = std::fabs(value);
+    if (!(x < 4294967296.0))
+        throw std::out_of_range("value out of range for BigFixed");
+
+    // Every step is exact: taking off the integer part and scaling by 2^32
+    result._negative = value < 0;
+    for (size_t i = result._limbs.size(); i-- > 0; )
+    {
+        double limb = std::floor(x);
+        result._limbs[i] = uint32_t(limb);
+        x = (x - limb) * 4294967296.0;
+    }
+    return result;
+}
+
+double BigFixed::toDouble() const
+{
+    double result = 0;
+    for (size_t i = 0; i < _limbs.size(); i++)
+        result += std::ldexp(double(_limbs[i]), 32 * (int(i) - int(fractionLimbs())));
+    return _negative ? -result : result;
+}
+
+int BigFixed::compareMagnitude(const BigFixed &a, const BigFixed &b)
+{
+    for (size_t i = a._limbs.size(); i-- > 0; )
+        if (a._limbs[i] != b._limbs[i])
+            return a._limbs[i] < b._limbs[i] ? -1 : 1;
+    return 0;
+}
+
+BigFixed BigFixed::addMagnitude(const BigFixed &a, const BigFixed &b)
+{
+    BigFixed result(a.fractionLimbs());
+    uint64_t carry = 0;
+    for (size_t i = 0; i < a._limbs.size(); i++)
+    {
+        carry += uint64_t(a._limbs[i]) + b._limbs[i];
+        result._limbs[i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    return result;
+}
+
+BigFixed BigFixed::subtractMagnitude(const BigFixed &a, const BigFixed &b)
+{
+    BigFixed result(a.fractionLimbs());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a._limbs.size(); i++)
+    {
+        int64_t difference = int64_t(a._limbs[i]) - b._limbs[i] - borrow;
+        borrow = difference < 0;
+        result._limbs[i] = uint32_t(difference + (borrow << 32));
+    }
+    return result;
+}
+
+BigFixed operator+(const BigFixed &a, const BigFixed &b)
+{
+    BigFixed result;
+    if (a._negative == b._negative)
+    {
+        result = BigFixed::addMagnitude(a, b);
+        result._negative = a._negative;
+    }
+    else if (BigFixed::compareMagnitude(a, b) >= 0)
+    {
+        result = BigFixed::subtractMagnitude(a, b);
+        result._negative = a._negative;
+    }
+    else
+    {
+        result = BigFixed::subtractMagnitude(b, a);
+        result._negative = b._negative;
+    }
+    return result;
+}
+
+BigFixed operator-(const BigFixed &a, const BigFixed &b)
+{
+    BigFixed negated = b;
+    negated._negative = !b._negative;
+    return a + negated;
+}
+
+BigFixed operator*(const BigFixed &a, const BigFixed &b)
+{
+    // Schoolbook product, of which the limbs from the binary point up are kept
+    const size_t n = a.fractionLimbs(), size = a._limbs.size();
+    std::vector<uint32_t> product(2 * size, 0);
+    for (size_t i = 0; i < size; i++)
+    {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < size; j++)
+        {
+            carry += uint64_t(a._limbs[i]) * b._limbs[j] + product[i + j];
+            product[i + j] = uint32_t(carry);
+            carry >>= 32;
+        }
+        product[i + size] = uint32_t(carry);
+    }
+
+    BigFixed result(n);
+    std::copy(product.begin() + n, product.begin() + n + size, result._limbs.begin());
+    result._negative = a._negative != b._negative;
+    return result;
+}
+
+size_t precisionLimbs(double pixelSize)
+{
+    int bits = int(std::ceil(-std::log2(pixelSize))) + 64;
+    return std::max(2, (bits + 31) / 32);
+}
+
+ReferenceOrbit::ReferenceOrbit(const BigFixed &cr, const BigFixed &ci, int maxIterations)
+{
+    BigFixed x(cr.fractionLimbs()), y(cr.fractionLimbs());
+    zr.reserve(maxIterations + 1);
+    zi.reserve(maxIterations + 1);
+    for (int n = 0; ; n++)
+    {
+        double r = x.toDouble(), i = y.toDouble();
+        zr.push_back(r);
+        zi.push_back(i);
+        if (n == maxIterations || r * r + i * i >= 4.0)
+            break;
+        BigFixed xy = x * y;
+        x = x * x - y * y + cr;
+        y = xy + xy + ci;
+    }
+}
+
+SeriesApproximation::SeriesApproximation(const ReferenceOrbit &orbit, double radius) : skip(0)
+{
+    const double r2 = radius * radius;
+    // Z_skip must not be the last point of the orbit, the point the reference escaped at
+    for (int n = 0; n + 2 < int(orbit.size()); n++)
+    {
+        const std::complex<double> twoZ(2 * orbit.zr[n], 2 * orbit.zi[n]);
+        const std::complex<double> nextA = twoZ * a + 1.0;
+        const std::complex<double> nextB = twoZ * b + a * a;
+        const std::complex<double> nextC = twoZ * c + 2.0 * a * b;
+        // The cubic term has to stay negligible next to the linear one for all |dc| <= radius
+        if (!(std::abs(nextC) * r2 <= 1e-6 * std::abs(nextA)))
+            break;
+        a = nextA;
+        b = nextB;
+        c = nextC;
+        skip = n + 1;
+    }
+}
+
+/*
+ Escape count of the point reference + dc like findMandelBrot, with |z|^2 at the escape in
+ magnitude. glitch is -1 for a good result, otherwise how badly the reference fits: the
+ |z|^2 / |Z|^2 that tripped the glitch test, or 1 when the reference escaped first.
+ */
+static int perturb(const ReferenceOrbit &orbit, const SeriesApproximation &series, double dcr,
+                   double dci, int maxIterations, double &magnitude, double &glitch)
+{
+    const std::complex<double> start = series.skip > 0 ? series(std::complex<double>(dcr, dci)) : 0.0;
+    const int last = int(orbit.size()) - 1;
+    double dzr = start.real(), dzi = start.imag();
+    glitch = -1;
+
+    for (int n = series.skip; n < maxIterations; n++)
+    {
+        if (n > last)
+        {
+            glitch = 1;
+            return n;
+        }
+        const double Zr = orbit.zr[n], Zi = orbit.zi[n];
+        const double zr = Zr + dzr, zi = Zi + dzi;
+        const double mag = zr * zr + zi * zi;
+        if (mag >= 4.0)
+        {
+            magnitude = mag;
+            return n;
+        }
+        const double reference = Zr * Zr + Zi * Zi;
+        if (mag < 1e-6 * reference)
+        {
+            glitch = mag / reference;
+            return n;
+        }
+        // dz = 2 Z dz + dz^2 + dc = (2 Z + dz) dz + dc
+        const double tr = 2.0 * Zr + dzr, ti = 2.0 * Zi + dzi;
+        const double r = tr * dzr - ti * dzi + dcr;
+        dzi = tr * dzi + ti * dzr + dci;
+        dzr = r;
+    }
+    return -1;
+}
+
+DeepStats renderDeep(const Frame &frame, PPMImage &image, ThreadPool &pool, int maxReferences)
+{
+    const RenderJob &job = frame.job;
+    const Palette &palette = frame.palette;
+    const int width = job.width, height = job.height;
+    const double pixel = 2 * job.deep.radius / height;
+    const size_t limbs = precisionLimbs(pixel);
+    const BigFixed cr = BigFixed::parse(job.deep.centerR, limbs);
+    const BigFixed ci = BigFixed::parse(job.deep.centerI, limbs);
+
+    // Offsets of the pixels from the center, rows go up in the imaginary direction like mapToImaginary
+    std::vector<double> dcr(width), dci(height);
+    for (int x = 0; x < width; x++)
+        dcr[x] = (x - 0.5 * width) * pixel;
+    for (int y = 0; y < height; y++)
+        dci[y] = (y - 0.5 * height) * pixel;
+
+    const size_t count = size_t(width) * height;
+    std::vector<int> n(count);
+    std::vector<double> magnitude(count), glitch(count);
+    std::vector<size_t> pending(count);
+    for (size_t p = 0; p < count; p++)
+        pending[p] = p;
+
+    DeepStats stats = { 0, 0, 0 };
+    double refR = 0, refI = 0; // the reference relative to the center
+    SeriesApproximation series;
+    while (!pending.empty() && stats.references < maxReferences)
+    {
+        const ReferenceOrbit orbit(cr + BigFixed::fromDouble(refR, limbs),
+                                   ci + BigFixed::fromDouble(refI, limbs), job.maxIterations);
+        // Later references only serve scattered glitches, they start from dz = 0
+        if (stats.references++ == 0)
+        {
+            series = SeriesApproximation(orbit, std::hypot(0.5 * width, 0.5 * height) * pixel);
+            stats.skipped = series.skip;
+        }
+        else
+            series = SeriesApproximation();
+
+        parallel_for(pool, Range{ 0, pending.size() }, 256, [&](size_t first, size_t last)
+        {
+            for (size_t k = first; k < last; k++)
+            {
+                const size_t p = pending[k];
+                n[p] = perturb(orbit, series, dcr[p % width] - refR, dci[p / width] - refI,
+                               job.maxIterations, magnitude[p], glitch[p]);
+            }
+        });
+
+        std::vector<size_t> glitched;
+        for (size_t p : pending)
+            if (glitch[p] >= 0)
+                glitched.push_back(p);
+        pending.swap(glitched);
+        if (pending.empty())
+            break;
+
+        // The worst glitch is closest to the point the new reference should be at
+        size_t worst = pending[0];
+        for (size_t p : pending)
+            if (glitch[p] < glitch[worst])
+                worst = p;
+        refR = dcr[worst % width];
+        refI = dci[worst / width];
+    }
+    stats.unresolved = int(pending.size());
+
+    const bool smooth = palette.isSmooth();
+    parallel_for(pool, Range{ 0, size_t(height) }, 1, [&](size_t first, size_t last)
+    {
+        for (size_t y = first; y < last; y++)
+        {
+            RGB<unsigned char> *row = image[y];
+            for (int x = 0; x < width; x++)
+            {
+                const size_t p = y * width + x;
+                row[x] = smooth ? palette.smooth(n[p], magnitude[p]) : palette[n[p]];
+            }
+        }
+    });
+    return stats;
+}
@@ -0,0 +1,96 @@
+// deepzoom.h
+
+#ifndef DEEPZOOM_H
+#define DEEPZOOM_H
+
+#include <complex>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mandelbrot.h"
+
+/*
+ Signed fixed point number with one 32 bit limb before the binary point and a chosen number of
+ limbs after it, enough for the few values below 16 a reference orbit needs. All operands of an
+ operation must have the same number of limbs.
+ */
+class BigFixed
+{
+public:
+    explicit BigFixed(size_t fractionLimbs = 2) : _negative(false), _limbs(fractionLimbs + 1, 0) { }
+
+    // Parses [-]digits[.digits]; throws std::invalid_argument for anything else
+    static BigFixed parse(const std::string &text, size_t fractionLimbs);
+    static BigFixed fromDouble(double value, size_t fractionLimbs);
+
+    double toDouble() const;
+    size_t fractionLimbs() const { return _limbs.size() - 1; }
+
+    friend BigFixed operator+(const BigFixed &a, const BigFixed &b);
+    friend BigFixed operator-(const BigFixed &a, const BigFixed &b);
+    friend BigFixed operator*(const BigFixed &a, const BigFixed &b);
+private:
+    static int compareMagnitude(const BigFixed &a, const BigFixed &b);
+    static BigFixed addMagnitude(const BigFixed &a, const BigFixed &b);
+    static BigFixed subtractMagnitude(const BigFixed &a, const BigFixed &b); // |a| >= |b|
+
+    bool _negative;
+    std::vector<uint32_t> _limbs; // least significant first, the last one is the integer part
+};
+
+// Fraction limbs needed to tell apart points pixelSize apart, with 64 bits to spare
+size_t precisionLimbs(double pixelSize);
+
+/*
+ The orbit Z_0 = 0, Z_n+1 = Z_n^2 + C of the reference point, computed in high precision and
+ stored rounded to doubles. It ends at the iteration the reference escapes, or after
+ maxIterations.
+ */
+struct ReferenceOrbit {
+    std::vector<double> zr, zi;
+
+    ReferenceOrbit(const BigFixed &cr, const BigFixed &ci, int maxIterations);
+    size_t size() const { return zr.size(); }
+};
+
+/*
+ Series approximation of the perturbation dz_n = A_n dc + B_n dc^2 + C_n dc^3 of points near
+ the reference. For every point within radius of it the series stays accurate for the first
+ skip iterations, which then need not be iterated at all.
+ */
+struct SeriesApproximation {
+    int skip;
+    std::complex<double> a, b, c;
+
+    SeriesApproximation() : skip(0) { }
+    SeriesApproximation(const ReferenceOrbit &orbit, double radius);
+    std::complex<double> operator()(std::complex<double> dc) const
+    {
+        return ((c * dc + b) * dc + a) * dc;
+    }
+};
+
+struct DeepStats {
+    int skipped;    // iterations the series approximation saved every pixel
+    int references; // reference orbits computed
+    int unresolved; // pixels still glitched when the reference budget ran out
+};
+
+/*
+ Renders frame.job around frame.job.deep with perturbation theory: one reference orbit is
+ computed in high precision at the center and every pixel iterates only its difference dz to
+ that orbit, in doubles:
+
+   dz_n+1 = 2 Z_n dz_n + dz_n^2 + dc
+
+ A pixel is glitched when the reference orbit cannot represent it: when |Z_n + dz_n| drops
+ below 1e-3 |Z_n| (Pauldelbrot's criterion) or when the reference escaped before the pixel did.
+ Glitched pixels are rendered again against a new reference placed at the most glitched one,
+ until none are left or maxReferences orbits were used. The escape counts match those of
+ findMandelBrot up to the rounding of doubles, so the palettes work unchanged; the kernel and
+ the shortcuts of the job are not used. Works down to a radius of about 1e-290, where the
+ pixel offsets leave the range of doubles.
+ */
+DeepStats renderDeep(const Frame &frame, PPMImage &image, ThreadPool &pool, int maxReferences = 64);
+
+#endif // DEEPZOOM_H
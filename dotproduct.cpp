@@ -0,0 +1,125 @@
+// dotproduct.cpp
+// Times the ways DotProduct can combine the partial results
+// Compile with:
+// g++ -std=c++11 -O2 -pthread dotproduct.cpp topology.cpp timing.cpp -o dotproduct
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "dotproduct.h"
+#include "topology.h"
+#include "timing.h"
+
+const struct { const char *name; Accumulation accumulation; } modes[] = {
+    { "mutex", Accumulation::Mutex },
+    { "atomic", Accumulation::Atomic },
+    { "reduction", Accumulation::Reduction },
+};
+
+const struct { const char *name; Summation summation; } summations[] = {
+    { "plain", Summation::Plain },
+    { "kahan", Summation::Kahan },
+    { "pairwise", Summation::Pairwise },
+};
+
+// Times the selected modes on vectors of 0.1 and 3 (1 and 2 for integers), false for an unknown mode.
+// With numa the vectors are filled by the workers that read them, see first_touch_fill.
+template <class T>
+bool run(const std::string &mode, int nr_elements, ThreadPool &pool, size_t nr_threads,
+         Summation summation, bool numa)
+{
+    const bool integral = std::is_integral<T>::value;
+    const T x = integral ? T(1) : T(0.1), y = T(integral ? 2 : 3);
+    FirstTouchVector<T> v1(nr_elements), v2(nr_elements);
+    if (numa) {
+        first_touch_fill(pool, v1, [x](size_t) { return x; }, nr_threads);
+        first_touch_fill(pool, v2, [y](size_t) { return y; }, nr_threads);
+    } else {
+        std::fill(v1.begin(), v1.end(), x);
+        std::fill(v2.begin(), v2.end(), y);
+    }
+    const Placement placement = numa ? Placement::ByPartition : Placement::Any;
+
+    bool found = false;
+    for (const auto &m : modes)
+    {
+        if (mode != "all" && mode != m.name)
+            continue;
+        found = true;
+        DotProduct<T, FirstTouchAllocator<T>> dp(pool, v1, v2, m.accumulation, nr_threads, summation,
+                                                 placement);
+        const Stopwatch watch;
+        typename DotTraits<T>::Accumulator result = dp();
+        const double seconds = watch.seconds();
+        std::cout << m.name << ": " << std::setprecision(17) << result << " in "
+                  << std::setprecision(6) << seconds << " seconds\n";
+    }
+    return found;
+}
+
+// usage: dotproduct [mutex|atomic|reduction|all] [elements] [threads] [int32|int64|float|double]
+//                   [plain|kahan|pairwise] [any|numa]
+// a thread count of 0 means CONCURRENT_THREADS or one per CPU, the vectors are split in that many partitions,
+// numa pins the workers and places every partition on the node of the worker that reads it
+int main(int argc, char *argv[])
+{
+    const std::string mode = argc > 1 ? argv[1] : "all";
+    const int nr_elements = argc > 2 ? std::atoi(argv[2]) : 10000000;
+    unsigned threads = argc > 3 ? std::atoi(argv[3]) : 0;
+    const std::string type = argc > 4 ? argv[4] : "int32";
+    const std::string summationName = argc > 5 ? argv[5] : "pairwise";
+    const std::string placement = argc > 6 ? argv[6] : "any";
+    if (threads == 0)
+        threads = unsigned(poolConfig().threads);
+
+    Summation summation = Summation::Pairwise;
+    bool known = false;
+    for (const auto &s : summations)
+        if (summationName == s.name)
+        {
+            summation = s.summation;
+            known = true;
+        }
+    if (!known)
+    {
+        std::cerr << "unknown summation " << summationName << std::endl;
+        return 1;
+    }
+
+    if (placement != "any" && placement != "numa")
+    {
+        std::cerr << "unknown placement " << placement << std::endl;
+        return 1;
+    }
+    const bool numa = placement == "numa";
+
+    // numa needs the workers pinned, to the CONCURRENT_PINNING policy or else one node after the other
+    ThreadPool pool(threads);
+    const Pinning pinning = numa && poolConfig().pinning == Pinning::None ? Pinning::Compact : poolConfig().pinning;
+    if (!applyPinning(pool, pinning) && numa)
+        std::cerr << "could not pin the workers, placing the data anyway" << std::endl;
+
+    bool found;
+    if (type == "int32")
+        found = run<int32_t>(mode, nr_elements, pool, threads, summation, numa);
+    else if (type == "int64")
+        found = run<int64_t>(mode, nr_elements, pool, threads, summation, numa);
+    else if (type == "float")
+        found = run<float>(mode, nr_elements, pool, threads, summation, numa);
+    else if (type == "double")
+        found = run<double>(mode, nr_elements, pool, threads, summation, numa);
+    else
+    {
+        std::cerr << "unknown element type " << type << std::endl;
+        return 1;
+    }
+    if (!found)
+    {
+        std::cerr << "unknown mode " << mode << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,463 @@
+// dotproduct.h
+
+#ifndef DOTPRODUCT_H
+#define DOTPRODUCT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include "threadpool.h"
+#include "cpu_features.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ How the workers combine their products:
+ Mutex     adds every product to the result under a lock
+ Atomic    adds every product to an atomic result
+ Reduction sums its partition into a local, stores it in its own cache line and the
+           partial sums are added up once all workers are done
+ Mutex and Atomic make every worker fight over the cache line of the result for every
+ element, they are there to show what that costs. Only Reduction uses the vectorized
+ loops and the Summation below.
+ */
+enum class Accumulation { Mutex, Atomic, Reduction };
+
+/*
+ How floating point products are summed:
+ Plain     straight into a few accumulators, the error grows with the length
+ Kahan     with compensated (Kahan) summation in every accumulator
+ Pairwise  blocks of products summed plainly, the block sums combined pairwise so the
+           error only grows with the logarithm of the length, at the speed of Plain
+ */
+enum class Summation { Plain, Kahan, Pairwise };
+
+/*
+ The type a dot product of T is accumulated in: products of 32 bit integers are exact in
+ 64 bits, sums of integers wrap around instead of overflowing, and floats are summed
+ as doubles, in which the product of two floats is exact.
+ */
+template <class T> struct DotTraits;
+template <> struct DotTraits<int32_t> { typedef int64_t Accumulator; };
+template <> struct DotTraits<int64_t> { typedef int64_t Accumulator; };
+template <> struct DotTraits<float> { typedef double Accumulator; };
+template <> struct DotTraits<double> { typedef double Accumulator; };
+
+// Compensated sum of a few values
+struct KahanSum {
+    double sum = 0, compensation = 0;
+
+    void add(double value)
+    {
+        double y = value - compensation;
+        double t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+};
+
+inline bool dotUseAVX2()
+{
+    return cpuFeatures().avx2 && cpuFeatures().fma;
+}
+
+template <class T>
+double dotPlainScalar(const T *a, const T *b, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += double(a[i]) * b[i];
+        s1 += double(a[i + 1]) * b[i + 1];
+        s2 += double(a[i + 2]) * b[i + 2];
+        s3 += double(a[i + 3]) * b[i + 3];
+    }
+    for (; i < n; ++i)
+        s0 += double(a[i]) * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+template <class T>
+double dotKahanScalar(const T *a, const T *b, size_t n)
+{
+    KahanSum sum;
+    for (size_t i = 0; i < n; ++i)
+        sum.add(double(a[i]) * b[i]);
+    return sum.sum;
+}
+
+#if HAVE_X86_SIMD
+// Four elements as doubles
+__attribute__((target("avx2,fma"))) inline __m256d dotLoad4(const double *p)
+{
+    return _mm256_loadu_pd(p);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256d dotLoad4(const float *p)
+{
+    return _mm256_cvtps_pd(_mm_loadu_ps(p));
+}
+
+template <class T>
+__attribute__((target("avx2,fma"))) double dotPlainAVX2(const T *a, const T *b, size_t n)
+{
+    // Four accumulators hide the latency of the FMA
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        s0 = _mm256_fmadd_pd(dotLoad4(a + i), dotLoad4(b + i), s0);
+        s1 = _mm256_fmadd_pd(dotLoad4(a + i + 4), dotLoad4(b + i + 4), s1);
+        s2 = _mm256_fmadd_pd(dotLoad4(a + i + 8), dotLoad4(b + i + 8), s2);
+        s3 = _mm256_fmadd_pd(dotLoad4(a + i + 12), dotLoad4(b + i + 12), s3);
+    }
+    for (; i + 4 <= n; i += 4)
+        s0 = _mm256_fmadd_pd(dotLoad4(a + i), dotLoad4(b + i), s0);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; ++i)
+        sum += double(a[i]) * b[i];
+    return sum;
+}
+
+template <class T>
+__attribute__((target("avx2,fma"))) double dotKahanAVX2(const T *a, const T *b, size_t n)
+{
+    // Kahan summation in every lane; the FMA makes y = a * b - c with a single rounding
+    __m256d s0 = _mm256_setzero_pd(), c0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd(), c1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d y0 = _mm256_fmsub_pd(dotLoad4(a + i), dotLoad4(b + i), c0);
+        __m256d y1 = _mm256_fmsub_pd(dotLoad4(a + i + 4), dotLoad4(b + i + 4), c1);
+        __m256d t0 = _mm256_add_pd(s0, y0);
+        __m256d t1 = _mm256_add_pd(s1, y1);
+        c0 = _mm256_sub_pd(_mm256_sub_pd(t0, s0), y0);
+        c1 = _mm256_sub_pd(_mm256_sub_pd(t1, s1), y1);
+        s0 = t0;
+        s1 = t1;
+    }
+
+    double sums[8], compensations[8];
+    _mm256_storeu_pd(sums, s0);
+    _mm256_storeu_pd(sums + 4, s1);
+    _mm256_storeu_pd(compensations, c0);
+    _mm256_storeu_pd(compensations + 4, c1);
+    KahanSum sum;
+    for (int k = 0; k < 8; ++k) {
+        sum.add(sums[k]);
+        sum.add(-compensations[k]);
+    }
+    for (; i < n; ++i)
+        sum.add(double(a[i]) * b[i]);
+    return sum.sum;
+}
+
+__attribute__((target("avx2,fma"))) inline int64_t dotAVX2(const int32_t *a, const int32_t *b, size_t n)
+{
+    // Sign extend to 64 bits, where _mm256_mul_epi32 gives the exact products
+    __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        __m256i xl = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(x));
+        __m256i yl = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(y));
+        __m256i xh = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(x, 1));
+        __m256i yh = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(y, 1));
+        s0 = _mm256_add_epi64(s0, _mm256_mul_epi32(xl, yl));
+        s1 = _mm256_add_epi64(s1, _mm256_mul_epi32(xh, yh));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(s0, s1));
+    uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i)
+        sum += uint64_t(int64_t(a[i]) * b[i]);
+    return int64_t(sum);
+}
+#endif
+
+template <class T>
+double dotPlain(const T *a, const T *b, size_t n)
+{
+#if HAVE_X86_SIMD
+    if (dotUseAVX2())
+        return dotPlainAVX2(a, b, n);
+#endif
+    return dotPlainScalar(a, b, n);
+}
+
+template <class T>
+double dotKahan(const T *a, const T *b, size_t n)
+{
+#if HAVE_X86_SIMD
+    if (dotUseAVX2())
+        return dotKahanAVX2(a, b, n);
+#endif
+    return dotKahanScalar(a, b, n);
+}
+
+template <class T>
+double dotPairwise(const T *a, const T *b, size_t n)
+{
+    const size_t block = 1024;
+    // The sums of 1, 2, 4, ... blocks still waiting for a partner, like a binary counter
+    double stack[64];
+    int top = 0;
+    for (size_t i = 0, count = 0; i < n; i += block, ++count) {
+        double sum = dotPlain(a + i, b + i, std::min(block, n - i));
+        for (size_t k = count; k & 1; k >>= 1)
+            sum = stack[--top] + sum;
+        stack[top++] = sum;
+    }
+    double sum = 0;
+    while (top > 0)
+        sum = stack[--top] + sum;
+    return sum;
+}
+
+// Dot product of n elements from a and b
+inline double dotRange(const double *a, const double *b, size_t n, Summation summation)
+{
+    switch (summation) {
+    case Summation::Plain: return dotPlain(a, b, n);
+    case Summation::Kahan: return dotKahan(a, b, n);
+    default: return dotPairwise(a, b, n);
+    }
+}
+
+inline double dotRange(const float *a, const float *b, size_t n, Summation summation)
+{
+    switch (summation) {
+    case Summation::Plain: return dotPlain(a, b, n);
+    case Summation::Kahan: return dotKahan(a, b, n);
+    default: return dotPairwise(a, b, n);
+    }
+}
+
+inline int64_t dotRange(const int32_t *a, const int32_t *b, size_t n, Summation)
+{
+#if HAVE_X86_SIMD
+    if (dotUseAVX2())
+        return dotAVX2(a, b, n);
+#endif
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += uint64_t(int64_t(a[i]) * b[i]);
+    return int64_t(sum);
+}
+
+inline int64_t dotRange(const int64_t *a, const int64_t *b, size_t n, Summation)
+{
+    // In unsigned arithmetic, where wrapping around is defined
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        sum += uint64_t(a[i]) * uint64_t(b[i]);
+    return int64_t(sum);
+}
+
+// atomic += for types without fetch_add in C++11
+template <class A>
+void atomicAdd(std::atomic<A> &target, A value)
+{
+    A old = target.load();
+    while (!target.compare_exchange_weak(old, old + value))
+        ;
+}
+
+inline void atomicAdd(std::atomic<int64_t> &target, int64_t value)
+{
+    target += value;
+}
+
+/*
+ Allocator that default-initializes, so a vector of numbers is left untouched until it is filled.
+ Linux places a page on the NUMA node of the thread that touches it first, which for a
+ FirstTouchVector filled by first_touch_fill is the worker that reads that part of it.
+ */
+template <class T>
+struct FirstTouchAllocator : std::allocator<T>
+{
+    template <class U> struct rebind { typedef FirstTouchAllocator<U> other; };
+
+    FirstTouchAllocator() { }
+    template <class U> FirstTouchAllocator(const FirstTouchAllocator<U> &) { }
+
+    template <class U> void construct(U *p) { ::new (static_cast<void *>(p)) U; }
+    template <class U, class... Args> void construct(U *p, Args &&... args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <class T>
+using FirstTouchVector = std::vector<T, FirstTouchAllocator<T>>;
+
+/*
+ Where the partitions run:
+ Any          on whichever worker gets to them first
+ ByPartition  partition i on worker i % pool.size(), the worker first_touch_fill filled it on
+ */
+enum class Placement { Any, ByPartition };
+
+// Bounds [L, R) of partition i when length elements are split in nr_threads parts
+inline void dot_partition(size_t length, size_t nr_threads, size_t i, size_t &L, size_t &R)
+{
+    size_t delta = length / nr_threads;
+    size_t remainder = length % nr_threads;
+    L = i * delta;
+    R = L + delta;
+    if (i == nr_threads - 1)
+        R += remainder;
+}
+
+/*
+ Sets v[k] = value(k) partition by partition, each partition on the worker a DotProduct with
+ the same nr_threads and Placement::ByPartition hands it to. With pinned workers (see
+ ThreadPool::pin_workers) and an untouched FirstTouchVector every page ends up on the NUMA
+ node that reads it.
+ */
+template <class Vector, class F>
+void first_touch_fill(ThreadPool &pool, Vector &v, F value, size_t nr_threads = 0)
+{
+    if (nr_threads == 0)
+        nr_threads = pool.size();
+    std::vector<std::future<void>> parts;
+    for (size_t i = 0; i < nr_threads; ++i) {
+        size_t L, R;
+        dot_partition(v.size(), nr_threads, i, L, R);
+        parts.push_back(pool.submit_to(i % pool.size(), [&v, &value, L, R]() {
+            for (size_t k = L; k < R; ++k)
+                v[k] = value(k);
+        }));
+    }
+    for (auto &part : parts) {
+        part.get();
+    }
+}
+
+/*
+ Parallel dot product of two vectors of int32_t, int64_t, float or double, computed in the
+ DotTraits accumulator of the type. The vectors are split into nr_threads partitions that
+ the pool works on, a nr_threads of 0 means one per worker.
+ */
+template <class T, class Allocator = std::allocator<T>>
+struct DotProduct
+{
+    typedef typename DotTraits<T>::Accumulator Accumulator;
+    typedef std::vector<T, Allocator> Vector;
+
+    DotProduct(ThreadPool &pool, const Vector &a, const Vector &b,
+               Accumulation accumulation = Accumulation::Reduction, size_t nr_threads = 0,
+               Summation summation = Summation::Pairwise, Placement placement = Placement::Any)
+        : pool(pool), a(a), b(b), accumulation(accumulation),
+          nr_threads(nr_threads == 0 ? pool.size() : nr_threads), summation(summation),
+          placement(placement)
+    {
+        if (a.size() != b.size())
+            throw "The vectors are of unequal length";
+    }
+
+    Accumulator operator()()
+    {
+        result = 0;
+        atomic_result = 0;
+        partials.assign(nr_threads, Partial());
+
+        // Hand the partitions to the pool
+        std::vector<std::future<void>> parts;
+        for (size_t i = 0; i < nr_threads; ++i) {
+            size_t L, R;
+            dot_partition(a.size(), nr_threads, i, L, R);
+            if (placement == Placement::ByPartition)
+                parts.push_back(pool.submit_to(i % pool.size(), &DotProduct::partial_dot_product,this,i,L,R));
+            else
+                parts.push_back(pool.submit(&DotProduct::partial_dot_product,this,i,L,R));
+        }
+        // Wait for the partitions
+        for (auto &part : parts) {
+            part.get();
+        }
+
+        if (accumulation == Accumulation::Atomic)
+            return atomic_result;
+        if (accumulation == Accumulation::Reduction)
+            return reduce();
+        return result;
+    }
+
+private:
+    // One partial sum per cache line, so the workers never write to the same line
+    struct Partial {
+        Accumulator sum;
+        char padding[64 - sizeof(Accumulator)];
+
+        Partial() : sum(0) { }
+    };
+
+    ThreadPool &pool;
+    const Vector &a;
+    const Vector &b;
+    Accumulation accumulation;
+    size_t nr_threads;
+    Summation summation;
+    Placement placement;
+    std::mutex mutex;
+
+    Accumulator result;
+    std::atomic<Accumulator> atomic_result;
+    std::vector<Partial> partials;
+
+    // Floating point partials add up with compensation, integers wrapping around
+    Accumulator reduce() const
+    {
+        return reduce(std::is_floating_point<Accumulator>());
+    }
+
+    Accumulator reduce(std::true_type) const
+    {
+        KahanSum sum;
+        for (const Partial &partial : partials)
+            sum.add(partial.sum);
+        return sum.sum;
+    }
+
+    Accumulator reduce(std::false_type) const
+    {
+        uint64_t sum = 0;
+        for (const Partial &partial : partials)
+            sum += uint64_t(partial.sum);
+        return Accumulator(sum);
+    }
+
+    void partial_dot_product(size_t part, size_t L, size_t R)
+    {
+        switch (accumulation) {
+        case Accumulation::Mutex:
+            for (size_t i = L; i < R; ++i) {
+                std::lock_guard<std::mutex> guard(mutex);
+                result += Accumulator(a[i]) * b[i];
+            }
+            break;
+        case Accumulation::Atomic:
+            for (size_t i = L; i < R; ++i)
+                atomicAdd(atomic_result, Accumulator(a[i]) * b[i]);
+            break;
+        case Accumulation::Reduction:
+            partials[part].sum = dotRange(a.data() + L, b.data() + L, R - L, summation);
+            break;
+        }
+    }
+
+};
+
+#endif // DOTPRODUCT_H
@@ -0,0 +1,30 @@
+// dotproductDemo.cpp
+// The Mutex and Atomic targets, one accumulation each
+// Compile with:
+// g++ -std=c++11 -pthread -DDOTPRODUCT_ACCUMULATION=Mutex dotproductDemo.cpp topology.cpp -o dotproduct
+
+#include <iostream>
+#include "dotproduct.h"
+#include "topology.h"
+
+#ifndef DOTPRODUCT_ACCUMULATION
+#define DOTPRODUCT_ACCUMULATION Mutex
+#endif
+
+int main()
+{
+    int nr_elements = 100000;
+
+    // Fill two vectors with some values 
+    std::vector<int> v1(nr_elements,1), v2(nr_elements,2);
+
+    // Create Functor object that runs on a pool sized by CONCURRENT_THREADS, or one worker per CPU
+    ThreadPool pool(poolConfig().threads);
+    applyPinning(pool, poolConfig().pinning);
+    DotProduct<int> dp(pool, v1, v2, Accumulation::DOTPRODUCT_ACCUMULATION);
+
+    // Print the result
+    std::cout << dp() << std::endl;
+
+    return 0;
+}
@@ -1,202 +1,211 @@
 // mandelbrot.cpp
-// compile with: g++ -std=c++11 mandelbrot.cpp -o mandelbrot
+// compile with: g++ -std=c++11 -pthread -ffp-contract=off mandelbrot.cpp render.cpp deepzoom.cpp topology.cpp
+//                   timing.cpp -o mandelbrot
 // view output with: eog mandelbrot.ppm
 
-#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
-#include <complex> // if you make use of complex number facilities in C++
+#include "mandelbrot.h"
+#include "deepzoom.h"
+#include "topology.h"
+#include "timing.h"
 
-template <class T> struct RGB { T r, g, b; };
-
-template <class T>
-class Matrix {
-public:
-    Matrix(const size_t rows, const size_t cols) : _rows(rows), _cols(cols) {
-        _matrix = new T*[rows];
-        for (size_t i = 0; i < rows; ++i) {
-            _matrix[i] = new T[cols];
-        }
-    }
-    Matrix(const Matrix &m) : _rows(m._rows), _cols(m._cols) {
-        _matrix = new T*[m._rows];
-        for (size_t i = 0; i < m._rows; ++i) {
-            _matrix[i] = new T[m._cols];
-            for (size_t j = 0; j < m._cols; ++j) {
-                _matrix[i][j] = m._matrix[i][j];
-            }
-        }
-    }
-    ~Matrix() {
-        for (size_t i = 0; i < _rows; ++i) {
-            delete [] _matrix[i];
-        }
-        delete [] _matrix;
-    }
-    T *operator[] (const size_t nIndex)
-    {
-        return _matrix[nIndex];
-    }
-    size_t width() const { return _cols; }
-    size_t height() const { return _rows; }
-protected:
-    size_t _rows, _cols;
-    T **_matrix;
-};
-
-// Portable PixMap image
-class PPMImage : public Matrix<RGB<unsigned char> >
-{
-public:
-    PPMImage(const size_t height, const size_t width) : Matrix(height, width) { }
-    void save(const std::string &filename)
-    {
-        std::ofstream out(filename, std::ios_base::binary);
-        out <<"P6" << std::endl << _cols << " " << _rows << std::endl << 255 << std::endl;
-        for (size_t y=0; y<_rows; y++)
-            for (size_t x=0; x<_cols; x++)
-                out << _matrix[y][x].r << _matrix[y][x].g << _matrix[y][x].b;
-    }
-};
-
-/*
- The function that calculates if a point is within the set or not
- */
-int findMandelBrot(double cr, double ci, int max_iterations)
-{
-    int i = 0;
-    double zr = 0.0, zi = 0.0;
-    while(i < max_iterations && zr * zr + zi * zi < 4.0)
-    {
-        double temp = zr * zr - zi * zi + cr;
-        zi =2.0 * zr * zi + ci;
-        zr = temp;
-        i++;
-    }
-
-    if(i >= max_iterations)
-        return -1;
-    return i;
-}
-
-/* Function that retrieves the real number*/
-double mapToReal (int x, int width, double minR, double maxR)
+static void usage()
 {
-    double range = maxR - minR;
-
-    return x * (range / width) + minR;
+    std::cerr << "usage: mandelbrot [options]\n"
+                 "  --threads N                 worker threads, 0 is CONCURRENT_THREADS or one per CPU (default)\n"
+                 "  --pin POLICY                none, compact, scatter or cores (CONCURRENT_PINNING or none)\n"
+                 "  --tile N                    tile size in pixels (32)\n"
+                 "  --kernel NAME               avx512, avx2, sse2 or scalar (the widest supported)\n"
+                 "  --band N                    stream the image to disk N rows at a time\n"
+                 "  --palette NAME              classic, flat or smooth (classic)\n"
+                 "  --shortcuts LIST            comma separated interior, periodicity, border or all\n"
+                 "  --size WxH                  picture size (1600x1300)\n"
+                 "  --iterations N              iteration cap (127)\n"
+                 "  --view MINR MAXR MINI MAXI  part of the complex plane (-2 0.7 -1.2 1.2)\n"
+                 "  --output FILE               output file (mandelbrot.ppm)\n"
+                 "  --deep CR CI RADIUS         deep zoom around CR + CI i, given in as many digits as\n"
+                 "                              needed, to RADIUS above and below it\n"
+                 "  --zoom FRAMES CR CI FACTOR  render FRAMES pictures, each zoomed in by FACTOR\n"
+                 "                              towards CR + CI i, to FILE with a frame number\n";
 }
 
-/* Function that retrieves the imaginary number*/
-double mapToImaginary(int y, int height, double minI, double maxI)
+static bool parseShortcuts(const std::string &arg, Shortcuts &shortcuts)
 {
-    double range = maxI - minI;
-
-    return y * (range / height) + minI;
-}
-
-/* Function that sets the color for each pixel*/
-int * getColor (int n)
-{
-    int * colors = new int[3];
-
-    if(n == -1)
+    std::string list = arg + ",";
+    for (size_t start = 0, end; (end = list.find(',', start)) != std::string::npos; start = end + 1)
     {
-        colors[0] = colors[1] = colors[2] = 0;
-    }
-    else if(n == 0)
-    {
-        colors[0] = 255;
-        colors[1] = colors[2] = 0;
-    }
-    else
-    {
-        if (n < 16) {
-            colors[0] = 16 * (16 - n);
-            colors[1] = 0;
-            colors[2] = 16 * n - 1;
-        } else if (n < 32) {
-            colors[0] = 0;
-            colors[1] = 16 * (n - 16);
-            colors[2] = 16 * (32 - n) - 1;
-        } else if (n < 64) {
-            colors[0] = 8 * (n - 32);
-            colors[1] = 8 * (64 - n) - 1;
-            colors[2] = 0;
-        } else { // range is 64 - 127
-            colors[0] = 255 - (n - 64) * 4;
-            colors[1] = colors[2] = 0;
+        std::string name = list.substr(start, end - start);
+        if (name == "interior" || name == "all") shortcuts.interiorTest = true;
+        if (name == "periodicity" || name == "all") shortcuts.periodicity = true;
+        if (name == "border" || name == "all") shortcuts.borderTracing = true;
+        if (name != "interior" && name != "periodicity" && name != "border" && name != "all" && name != "")
+        {
+            std::cerr << "unknown shortcut " << name << std::endl;
+            return false;
         }
     }
-
-    return colors;
+    return true;
 }
 
-/* This function sets the needed variables for the mandelbrot aswell as calculating and drawing it */
-void mandelbrot(int minX, int maxX, int width, int height, PPMImage &image){
-    const int maxIterations = 127;
-    const double minR = -2.0;
-    const double maxR = 0.7;
-    const double minI = -1.2;
-    const double maxI = 1.2;
+int main(int argc, char *argv[])
+    {
+    RenderJob job = defaultJob();
+    unsigned threads = 0;
+    Pinning pinning = poolConfig().pinning;
+    int zoomFrames = 0;
+    double zoomR = 0, zoomI = 0, zoomFactor = 1;
 
-    for (int i = 0; i < height; i++) //Rows
+    for (int a = 1; a < argc; a++)
     {
-        for(int j = minX; j < maxX; j++) //Pixels in row
+        const std::string option = argv[a];
+        // number of values that follow the option
+        const int values = option == "--view" || option == "--zoom" ? 4 : option == "--deep" ? 3 : 1;
+        if (a + values >= argc)
         {
-            double cr = mapToReal(j, width, minR, maxR);
-            double ci = mapToImaginary(i, height, minI, maxI);
-
-            int n = findMandelBrot(cr, ci, maxIterations);
-
-            int* colors = getColor(n);
-            image[i][j].r = colors[0];
-            image[i][j].g = colors[1];
-            image[i][j].b = colors[2];
-
-            delete colors;
+            usage();
+            return 1;
+        }
+        const char *value = argv[a + 1];
 
-            //This coloring is way faster but less pretty
-/*            if(n == -1){
-                image[i][j].r = image[i][j].g = image[i][j].b = 0;
-            } else{
-                image[i][j].r = image[i][j].g = image[i][j].b = 100;
-            }*/
+        if (option == "--threads")
+            threads = std::atoi(value);
+        else if (option == "--pin")
+        {
+            if (!parsePinning(value, pinning))
+            {
+                std::cerr << "unknown pinning " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--tile")
+            job.tileSize = std::atoi(value);
+        else if (option == "--band")
+            job.bandRows = std::atoi(value);
+        else if (option == "--iterations")
+            job.maxIterations = std::atoi(value);
+        else if (option == "--output")
+            job.output = value;
+        else if (option == "--kernel")
+        {
+            job.kernel = selectKernel(value);
+            if (job.kernel == nullptr)
+            {
+                std::cerr << "unknown or unsupported kernel " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--palette")
+        {
+            job.palette = findPalette(value);
+            if (job.palette == nullptr)
+            {
+                std::cerr << "unknown palette " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--shortcuts")
+        {
+            if (!parseShortcuts(value, job.shortcuts))
+                return 1;
         }
+        else if (option == "--size")
+        {
+            if (std::sscanf(value, "%dx%d", &job.width, &job.height) != 2)
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (option == "--view")
+        {
+            job.view.minR = std::atof(argv[a + 1]);
+            job.view.maxR = std::atof(argv[a + 2]);
+            job.view.minI = std::atof(argv[a + 3]);
+            job.view.maxI = std::atof(argv[a + 4]);
+        }
+        else if (option == "--deep")
+        {
+            job.deep.centerR = argv[a + 1];
+            job.deep.centerI = argv[a + 2];
+            job.deep.radius = std::atof(argv[a + 3]);
+            if (!(1e-290 <= job.deep.radius && job.deep.radius <= 4))
+            {
+                std::cerr << "the deep zoom radius must be between 1e-290 and 4" << std::endl;
+                return 1;
+            }
+        }
+        else if (option == "--zoom")
+        {
+            zoomFrames = std::atoi(argv[a + 1]);
+            zoomR = std::atof(argv[a + 2]);
+            zoomI = std::atof(argv[a + 3]);
+            zoomFactor = std::atof(argv[a + 4]);
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+        a += values;
     }
-}
 
-int main()
+    if (job.tileSize <= 0 || job.width <= 0 || job.height <= 0 || job.maxIterations <= 0 ||
+        job.bandRows < 0 || zoomFrames < 0)
     {
-    const unsigned width = 1600;
-    const unsigned height = 1300;
-    const unsigned threads = 4;
-
-    PPMImage image(height, width);
+        std::cerr << "sizes, counts and the iteration cap must be positive" << std::endl;
+        return 1;
+    }
+    if (job.deep.radius > 0 && job.bandRows > 0)
+    {
+        std::cerr << "deep zooms cannot be streamed" << std::endl;
+        return 1;
+    }
+    if (threads == 0)
+        threads = unsigned(poolConfig().threads);
 
-    std::vector<std::thread> workers;
+    ThreadPool pool(threads);
+    if (!applyPinning(pool, pinning))
+        std::cerr << "could not pin the workers" << std::endl;
 
-    clock_t start_clock = clock();
-    for (int i = 0; i < threads; i++)
+    if (zoomFrames > 0)
     {
-        int part = width / threads;
-        int minX = part * i;
-        int maxX = part * (i+1);
+        try {
+            renderBatch(zoomSequence(job, zoomR, zoomI, zoomFactor, zoomFrames), pool);
+        } catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-        workers.emplace_back(std::thread([minX, maxX, width, height, &image]()
-        {
-            mandelbrot(minX, maxX, width, height, std::ref(image));
-        }));
-    };
-    for(auto &th : workers)
+    const Stopwatch watch;
+    if (job.deep.radius > 0)
     {
-        th.join();
+        const Palette palette(job.palette->coloring, job.maxIterations, job.palette->steps);
+        const Frame frame = { job, palette };
+        PPMImage image(job.height, job.width);
+        DeepStats stats;
+        try {
+            stats = renderDeep(frame, image, pool);
+        } catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << watch.seconds() << " seconds (deep zoom, "
+                  << stats.references << " references, " << stats.skipped << " iterations skipped, "
+                  << stats.unresolved << " glitched pixels left)\n";
+        image.save(job.output);
+        return 0;
     }
-    clock_t stop_clock = clock();
-    std::cout << (double(stop_clock - start_clock) / CLOCKS_PER_SEC) << " seconds\n";
-    image.save("mandelbrot.ppm");
+    renderJob(job, pool);
+    std::cout << watch.seconds() << " seconds ("
+              << job.kernel->name << " kernel)\n";
     return 0;
 }
-
-
@@ -0,0 +1,191 @@
+// mandelbrot.h
+
+#ifndef MANDELBROT_H
+#define MANDELBROT_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "ppm.h"
+#include "threadpool.h"
+
+/*
+ The function that calculates if a point is within the set or not
+ */
+int findMandelBrot(double cr, double ci, int max_iterations);
+int findMandelBrot(double cr, double ci, int max_iterations, double &magnitude);
+
+/*
+ Vectorized versions of findMandelBrot that work on 2 (SSE2), 4 (AVX2) or 8 (AVX-512) points
+ at once. They do exactly the same floating point operations in the same order as the scalar
+ loop, so the results are identical as long as the compiler does not fuse them into FMAs
+ (hence -ffp-contract=off). A lane that escapes is masked off for good and stops counting,
+ the loop ends when all lanes escaped or max_iterations is reached.
+ The Smooth versions also record |z|^2 of every lane at its escape.
+ The Periodic versions keep the z of iteration 1, 2, 4, 8, ... and compare every new z against
+ the last one kept (Brent's cycle detection). A lane whose z repeats exactly is caught in a
+ cycle it can never leave, so it counts as inside the set right away. That is the answer the
+ full loop would have given, so this shortcut does not change the image.
+ */
+typedef void (*KernelFunction)(const double *cr, const double *ci, int max_iterations, int *n, double *magnitude);
+
+struct EscapeKernel {
+    const char *name;
+    int lanes;
+    KernelFunction variants[4]; // indexed by smooth + 2 * periodic
+
+    KernelFunction variant(bool smooth, bool periodic) const
+    {
+        return variants[(smooth ? 1 : 0) + (periodic ? 2 : 0)];
+    }
+};
+
+/* Returns the kernel with the given name, or the widest one this CPU supports if name is empty.
+   Returns nullptr for unknown or unsupported kernels */
+const EscapeKernel *selectKernel(const std::string &name);
+
+/*
+ A palette maps iteration counts to colors through a lookup table that is built once for a
+ given maxIterations, so coloring a pixel is a single table lookup. A coloring function
+ fills the table; palettes with steps > 1 are smooth: the table has steps entries per
+ iteration and is indexed with the fractional (continuous) iteration count.
+ */
+class Palette
+{
+public:
+    typedef RGB<unsigned char> (*Coloring)(double n, int maxIterations);
+
+    Palette(Coloring coloring, int maxIterations, int steps = 1)
+        : _steps(steps), _table(1 + size_t(maxIterations) * steps)
+    {
+        _table[0] = coloring(-1, maxIterations); // the interior
+        for (size_t k = 1; k < _table.size(); k++)
+            _table[k] = coloring(double(k - 1) / steps, maxIterations);
+    }
+    // Color of a point that escaped after n iterations, n is -1 inside the set
+    const RGB<unsigned char> &operator[](int n) const
+    {
+        return _table[n < 0 ? 0 : 1 + size_t(n) * _steps];
+    }
+    // Color for the escape count n and |z|^2 at the escape of a smooth palette
+    const RGB<unsigned char> &smooth(int n, double magnitude) const
+    {
+        if (n < 0)
+            return _table[0];
+        // n + 1 - log2(log2 |z|) runs from n - 1 to n + 1 for a bailout radius of 2
+        double nu = n + 1 - std::log2(0.5 * std::log2(magnitude));
+        double k = std::floor(nu * _steps);
+        k = std::max(0.0, std::min(k, double(_table.size() - 2)));
+        return _table[1 + size_t(k)];
+    }
+    bool isSmooth() const { return _steps > 1; }
+private:
+    int _steps;
+    std::vector<RGB<unsigned char> > _table; // entry 0 is the interior, 1 + k is count k / steps
+};
+
+// A named coloring function and the number of table entries per iteration it wants
+struct PaletteType {
+    const char *name;
+    Palette::Coloring coloring;
+    int steps;
+};
+
+// classic, flat or smooth; nullptr for other names
+const PaletteType *findPalette(const std::string &name);
+
+/*
+ Optional shortcuts, all off by default so the brute force image stays the reference:
+ interiorTest  skips points in the main cardioid and the period-2 bulb, which are inside the set
+ periodicity   stops iterating points whose orbit runs into an exact cycle (see EscapeKernel)
+ borderTracing fills a rectangle in one go when its whole border has the same iteration count
+               (Mariani-Silver); with a smooth palette only when that border is inside the set
+ */
+struct Shortcuts {
+    bool interiorTest;
+    bool periodicity;
+    bool borderTracing;
+};
+
+// The part of the complex plane that is mapped onto the picture
+struct Viewport {
+    double minR, maxR;
+    double minI, maxI;
+};
+
+/*
+ A view too deep for doubles: the center as decimal strings of any precision and the distance
+ from the center to the top and bottom edge. A radius of 0 means the job uses its Viewport.
+ */
+struct DeepZoom {
+    std::string centerR, centerI;
+    double radius;
+};
+
+/*
+ Everything that describes one picture: what to render, how, and where to write it.
+ With bandRows > 0 the picture is streamed to the output bandRows rows at a time, with
+ deep.radius > 0 it is rendered by the deep zoom engine (deepzoom.h) instead of the kernel,
+ whole, as deep zooms are never streamed.
+ */
+struct RenderJob {
+    Viewport view;
+    int width, height;
+    int maxIterations;
+    const PaletteType *palette;
+    const EscapeKernel *kernel;
+    Shortcuts shortcuts;
+    DeepZoom deep;
+    int tileSize;
+    int bandRows;
+    std::string output;
+};
+
+// The original 1600x1300, 127 iteration picture with the classic palette and the widest kernel
+RenderJob defaultJob();
+
+// A job together with the palette table built for it, what the render functions work from
+struct Frame {
+    const RenderJob &job;
+    const Palette &palette;
+};
+
+/* Function that retrieves the real number*/
+double mapToReal (int x, int width, double minR, double maxR);
+
+/* Function that retrieves the imaginary number*/
+double mapToImaginary(int y, int height, double minI, double maxI);
+
+bool inCardioidOrBulb(double cr, double ci);
+void escapeCounts(const Frame &frame, const double *cr, const double *ci, int count, int *n,
+                  double *magnitude);
+void mandelbrot(const Frame &frame, int minX, int maxX, int minY, int maxY, PPMImage &image,
+                int firstRow = 0);
+void borderTrace(const Frame &frame, int minX, int maxX, int minY, int maxY, PPMImage &image,
+                 int firstRow);
+void renderTiles(const Frame &frame, PPMImage &image, int firstRow, int rows, ThreadPool &pool);
+void renderTiles(const Frame &frame, PPMImage &image, ThreadPool &pool);
+void renderStreaming(const Frame &frame, ThreadPool &pool);
+
+// Renders job and writes it to job.output
+void renderJob(const RenderJob &job, ThreadPool &pool);
+
+/*
+ Renders a sequence of jobs on one pool. Frame N is written to disk by a pool task while
+ frame N+1 renders, and palette tables are only rebuilt when the palette or maxIterations
+ of a job differs from the previous one.
+ */
+void renderBatch(const std::vector<RenderJob> &jobs, ThreadPool &pool);
+
+/*
+ frames jobs that zoom from start.view towards (centerR, centerI) by factor per frame. Frame k
+ is written to start.output with k in place of its one %d, or of a %0Nd as N digits (like
+ frame%04d.ppm); an output without a % gets a four digit frame number before its extension.
+ Any other % throws std::invalid_argument. Deep jobs keep their own center and only shrink
+ deep.radius.
+ */
+std::vector<RenderJob> zoomSequence(const RenderJob &start, double centerR, double centerI,
+                                    double factor, int frames);
+
+#endif // MANDELBROT_H
@@ -0,0 +1,165 @@
+// mnk.h
+// m,n,k-games: K in a row on a Rows x Cols board, tic-tac-toe being the 3,3,3-game
+
+#ifndef MNK_H
+#define MNK_H
+
+#include <array>
+#include <vector>
+#include <iostream>
+#include "ttt_mc.h"
+#include "threadpool.h"
+
+template<int Rows, int Cols, int K>
+struct MnkBoard {
+    static_assert(Rows > 0 && Cols > 0 && K > 0 && (K <= Rows || K <= Cols), "no line of K fits on the board");
+    static const int rows = Rows, cols = Cols, squares = Rows * Cols;
+
+    std::array<Player, squares> cells;
+    Player toMove;
+    Player winner; // set by the move that makes a line of K
+    int filled;
+
+    MnkBoard(): toMove(Player::X), winner(Player::None), filled(0) { cells.fill(Player::None); }
+};
+
+template<int R, int C, int K>
+Player getCurrentPlayer(const MnkBoard<R,C,K> &board) { return board.toMove; }
+
+template<int R, int C, int K>
+Player getWinner(const MnkBoard<R,C,K> &board) { return board.winner; }
+
+template<int R, int C, int K>
+bool isOver(const MnkBoard<R,C,K> &board)
+{
+    return board.winner != Player::None || board.filled == board.squares;
+}
+
+template<int R, int C, int K>
+std::vector<Move> getMoves(const MnkBoard<R,C,K> &board)
+{
+    std::vector<Move> moves;
+    if (!isOver(board)) {
+        for (int i=0; i<board.squares; i++) {
+            if (board.cells[i] == Player::None) moves.push_back(i);
+        }
+    }
+    return moves;
+}
+
+// True when the piece on m is part of a line of K: only the lines through m are counted
+template<int R, int C, int K>
+bool makesLine(const MnkBoard<R,C,K> &board, Move m)
+{
+    static const int directions[4][2] = { { 0, 1 }, { 1, 0 }, { 1, 1 }, { 1, -1 } };
+    const Player p = board.cells[m];
+    const int row = m / C, col = m % C;
+    for (const auto &d : directions) {
+        int length = 1;
+        for (int sign = -1; sign <= 1; sign += 2) {
+            int r = row + sign * d[0], c = col + sign * d[1];
+            for (; r >= 0 && r < R && c >= 0 && c < C && board.cells[r*C+c] == p; r += sign * d[0], c += sign * d[1])
+                length++;
+        }
+        if (length >= K) return true;
+    }
+    return false;
+}
+
+// Plays m in place, m must be empty and the game not over
+template<int R, int C, int K>
+void playMove(MnkBoard<R,C,K> &board, Move m)
+{
+    board.cells[m] = board.toMove;
+    board.filled++;
+    if (makesLine(board, m)) board.winner = board.toMove;
+    board.toMove = board.toMove == Player::X ? Player::O : Player::X;
+}
+
+template<int R, int C, int K>
+MnkBoard<R,C,K> doMove(MnkBoard<R,C,K> board, const Move &m)
+{
+    playMove(board, m);
+    return board;
+}
+
+// Plays random moves from board until the game is over, without allocating
+template<int R, int C, int K>
+MnkBoard<R,C,K> playout(MnkBoard<R,C,K> board, Xoshiro128 &rng)
+{
+    std::array<Move, R*C> moves;
+    int count = 0;
+    for (int i=0; i<board.squares; i++) {
+        if (board.cells[i] == Player::None) moves[count++] = i;
+    }
+    while (count > 0 && board.winner == Player::None) {
+        int k = rng.below(count);
+        playMove(board, moves[k]);
+        moves[k] = moves[--count];
+    }
+    return board;
+}
+
+template<int R, int C, int K>
+std::ostream &operator<<(std::ostream &os, const MnkBoard<R,C,K> &board)
+{
+    for (int r=0; r<R; r++) {
+        for (int c=0; c<C; c++) os << "+-";
+        os << "+" << std::endl;
+        for (int c=0; c<C; c++) os << "|" << board.cells[r*C+c];
+        os << "|" << std::endl;
+    }
+    for (int c=0; c<C; c++) os << "+-";
+    os << "+" << std::endl;
+    return os;
+}
+
+/*
+ Flat Monte Carlo like mcMove for any board: trials random playouts from board, split over
+ threads tasks on the pool. For every playout the squares of the winner score a point and
+ those of the loser lose one, and the empty square with the highest score is played. Every
+ task scores into its own part of one array, padded to whole cache lines, which is added up
+ once all are done.
+ */
+template<int R, int C, int K>
+Move mnkMcMove(const MnkBoard<R,C,K> &board, ThreadPool &pool, unsigned threads, unsigned trials, uint64_t seed)
+{
+    const int stride = (R*C + 15) / 16 * 16 + 16; // whole 64 byte lines and one to spare between tasks
+    const Player player = board.toMove;
+    std::vector<int> scores(size_t(stride) * threads, 0);
+    {
+        TaskGroup group(pool);
+        for (unsigned t = 0; t < threads; t++) {
+            group.submit([&, t]() {
+                Xoshiro128 &rng = threadRng();
+                rng.reseed(seed + t);
+                int *own = &scores[size_t(stride) * t];
+                for (unsigned i = t; i < trials; i += threads) {
+                    MnkBoard<R,C,K> end = playout(board, rng);
+                    if (end.winner == Player::None) continue;
+                    int sign = end.winner == player ? 1 : -1;
+                    for (int s=0; s<R*C; s++) {
+                        if (end.cells[s] == player) own[s] += sign;
+                        else if (end.cells[s] != Player::None) own[s] -= sign;
+                    }
+                }
+            });
+        }
+        group.wait();
+    }
+
+    Move best = -1;
+    int bestScore = 0;
+    for (int s=0; s<R*C; s++) {
+        if (board.cells[s] != Player::None) continue;
+        int score = 0;
+        for (unsigned t = 0; t < threads; t++) score += scores[size_t(stride) * t + s];
+        if (best < 0 || score > bestScore) {
+            best = s;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+#endif // MNK_H
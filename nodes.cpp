@@ -0,0 +1,423 @@
+// nodes.cpp
+// The node classes behind Tree, and the compiled Program
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <limits>
+#include <thread>
+#include "tree.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+int valtab[127];
+
+// a + b, but never more than the largest size_t
+size_t add_sizes(size_t a, size_t b)
+{
+    return a > numeric_limits<size_t>::max() - b ? numeric_limits<size_t>::max() : a + b;
+}
+
+void Tree::operator=(const Tree &t)
+{
+    acquire(t.p);
+    release(p);
+    p = t.p;
+}
+
+ostream& operator<<(ostream &os, const Tree &t)
+{
+    t.p->print(os);
+    return os;
+}
+
+class LeafNode: public Node {
+private:
+    friend class Tree;
+    void print(ostream &os) = 0;
+    virtual int eval() = 0;
+    virtual void compile(Program &program) = 0;
+};
+
+class IntNode: public LeafNode {
+public:
+    int eval() { return n; }
+private:
+    friend class Tree;
+    friend class NodeArena;
+    int n;
+    void print(ostream &os) { os << n ;}
+    void compile(Program &program) { program.emit(Opcode::Push, n); }
+    IntNode(int k): n(k) { }
+};
+
+class IdNode: public LeafNode {
+public:
+    int eval() { return valtab[int(name)]; }
+private:
+    friend class Tree;
+    friend class NodeArena;
+    char name;
+    void print(ostream& o) { o << name; }
+    void compile(Program &program) { program.emit(Opcode::Load, program.slot(name)); }
+    IdNode(char id): name(id) { }
+};
+
+class UnaryNode: public Node {
+public:
+    int eval() { return apply(opnd.eval()); }
+    int eval(ThreadPool &pool, size_t threshold) { return apply(opnd.eval(pool, threshold)); }
+    int eval(Memo &memo);
+private:
+    friend class Tree;
+    friend class NodeArena;
+    const char op;
+    Tree opnd;
+    UnaryNode(char a, Tree b): Node(add_sizes(1, b.size())), op(a), opnd(b) { }
+    void print(ostream& o) { o << "(" << op << opnd << ")"; }
+    void compile(Program &program);
+    int arity() const { return 1; }
+    const Tree *operand(int i) const { return i == 0 ? &opnd : nullptr; }
+    int combine(int value, int) { return apply(value); }
+    int apply(int value);
+};
+
+void UnaryNode::compile(Program &program)
+{
+    opnd.compile(program);
+    switch (op) {
+        case '-': program.emit(Opcode::Negate); break;
+        case '+': break;
+        default: cerr << "no operand" << endl;
+            program.emit(Opcode::Zero);
+    }
+}
+
+int UnaryNode::eval(Memo &memo)
+{
+    Memo::iterator known = memo.find(this);
+    if (known != memo.end())
+        return known->second;
+    return memo[this] = apply(opnd.eval(memo));
+}
+
+int UnaryNode::apply(int value)
+{
+    switch (op) {
+        case '-': return (-value);
+        case '+': return (+value);
+        default: cerr << "no operand" << endl;
+            return 0;
+    }
+}
+
+class BinaryNode: public Node {
+public:
+    int eval() { return apply(left.eval(), right.eval()); }
+    int eval(ThreadPool &pool, size_t threshold);
+    int eval(Memo &memo);
+private:
+    friend class Tree;
+    friend class NodeArena;
+    const char op;
+    Tree left;
+    Tree right;
+    BinaryNode(char a, Tree b, Tree c)
+        : Node(add_sizes(1, add_sizes(b.size(), c.size()))), op(a), left(b), right(c) { }
+    void print(ostream &os) { os << "(" << left << op << right << ")"; }
+    void compile(Program &program);
+    int arity() const { return 2; }
+    const Tree *operand(int i) const { return i == 0 ? &left : i == 1 ? &right : nullptr; }
+    int combine(int leftvalue, int rightvalue) { return apply(leftvalue, rightvalue); }
+    int apply(int leftvalue, int rightvalue);
+};
+
+void BinaryNode::compile(Program &program)
+{
+    left.compile(program);
+    right.compile(program);
+    switch (op) {
+        case '-': program.emit(Opcode::Subtract); break;
+        case '+': program.emit(Opcode::Add); break;
+        case '*': program.emit(Opcode::Multiply); break;
+        default: cerr << "no operand" << endl;
+            program.emit(Opcode::Subtract); // drops one operand
+            program.emit(Opcode::Zero);
+    }
+}
+
+/*
+ Subtrees below threshold nodes are evaluated inline, recursively. A bigger left subtree is
+ handed to the pool while this thread does the right one; the tasks fork the same way. Until
+ the left value is there the thread runs other queued tasks, so no worker ever sits blocked.
+ The task refers to left instead of copying it: this node outlives the task, so an atomic
+ reference count increment and decrement per fork would buy nothing.
+ */
+int BinaryNode::eval(ThreadPool &pool, size_t threshold)
+{
+    if (size < threshold || left.size() < threshold)
+        return apply(left.eval(), right.eval(pool, threshold));
+
+    std::future<int> task = pool.submit([this, &pool, threshold]() { return left.eval(pool, threshold); });
+    int rightvalue = right.eval(pool, threshold);
+    while (task.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        if (!pool.run_one())
+            std::this_thread::yield();
+    int leftvalue = task.get();
+    return apply(leftvalue, rightvalue);
+}
+
+int BinaryNode::eval(Memo &memo)
+{
+    Memo::iterator known = memo.find(this);
+    if (known != memo.end())
+        return known->second;
+    int leftvalue = left.eval(memo);
+    int rightvalue = right.eval(memo);
+    return memo[this] = apply(leftvalue, rightvalue);
+}
+
+int BinaryNode::apply(int leftvalue, int rightvalue)
+{
+    switch (op) {
+        case '-': return (leftvalue - rightvalue);
+        case '+': return (leftvalue + rightvalue);
+        case '*': return (leftvalue * rightvalue);
+        default: cerr << "no operand" << endl;
+            return 0;
+    }
+
+}
+
+void Program::emit(Opcode op, int operand)
+{
+    Instruction instruction = { op, operand };
+    code.push_back(instruction);
+    if (op == Opcode::Push || op == Opcode::Load)
+        max_depth = max(max_depth, ++depth);
+    else if (op == Opcode::Add || op == Opcode::Subtract || op == Opcode::Multiply)
+        --depth;
+}
+
+int Program::slot(char name)
+{
+    for (size_t s = 0; s < vars.size(); ++s)
+        if (vars[s] == name)
+            return s;
+    vars.push_back(name);
+    return vars.size() - 1;
+}
+
+int Program::eval(const int *table) const
+{
+    // unsigned, where overflow wraps instead of being undefined
+    static thread_local vector<unsigned> stack;
+    stack.resize(max(size_t(max_depth), stack.size()));
+    unsigned *top = stack.data(); // one past the top of the stack
+    for (const Instruction &in : code) {
+        switch (in.op) {
+            case Opcode::Push: *top++ = in.operand; break;
+            case Opcode::Load: *top++ = table[int(vars[in.operand])]; break;
+            case Opcode::Negate: top[-1] = 0u - top[-1]; break;
+            case Opcode::Add: --top; top[-1] += top[0]; break;
+            case Opcode::Subtract: --top; top[-1] -= top[0]; break;
+            case Opcode::Multiply: --top; top[-1] *= top[0]; break;
+            case Opcode::Zero: top[-1] = 0; break;
+        }
+    }
+    return int(top[-1]);
+}
+
+/*
+ Evaluates bindings first .. first+7 with every stack slot holding the values of all 8;
+ the same code as eval with a loop over the lanes, for the compiler to vectorize.
+ */
+void Program::eval_block(const int *bindings, size_t count, size_t first, int *results) const
+{
+    static thread_local vector<Lanes> stack;
+    stack.resize(max(size_t(max_depth), stack.size()));
+    Lanes *top = stack.data();
+    for (const Instruction &in : code) {
+        switch (in.op) {
+            case Opcode::Push:
+                for (int l = 0; l < lanes; ++l) top->v[l] = in.operand;
+                ++top;
+                break;
+            case Opcode::Load: {
+                const int *column = bindings + in.operand * count + first;
+                for (int l = 0; l < lanes; ++l) top->v[l] = column[l];
+                ++top;
+                break;
+            }
+            case Opcode::Negate:
+                for (int l = 0; l < lanes; ++l) top[-1].v[l] = 0u - top[-1].v[l];
+                break;
+            case Opcode::Add:
+                --top;
+                for (int l = 0; l < lanes; ++l) top[-1].v[l] += top->v[l];
+                break;
+            case Opcode::Subtract:
+                --top;
+                for (int l = 0; l < lanes; ++l) top[-1].v[l] -= top->v[l];
+                break;
+            case Opcode::Multiply:
+                --top;
+                for (int l = 0; l < lanes; ++l) top[-1].v[l] *= top->v[l];
+                break;
+            case Opcode::Zero:
+                for (int l = 0; l < lanes; ++l) top[-1].v[l] = 0;
+                break;
+        }
+    }
+    for (int l = 0; l < lanes; ++l)
+        results[first + l] = int(top[-1].v[l]);
+}
+
+#if HAVE_X86_SIMD
+__attribute__((target("avx2")))
+void Program::eval_block_avx2(const int *bindings, size_t count, size_t first, int *results) const
+{
+    static thread_local vector<int> memory;
+    memory.resize(max(size_t(max_depth) * lanes, memory.size()));
+    int *top = memory.data();
+    for (const Instruction &in : code) {
+        switch (in.op) {
+            case Opcode::Push:
+                _mm256_storeu_si256((__m256i *)top, _mm256_set1_epi32(in.operand));
+                top += lanes;
+                break;
+            case Opcode::Load:
+                _mm256_storeu_si256((__m256i *)top,
+                                    _mm256_loadu_si256((const __m256i *)(bindings + in.operand * count + first)));
+                top += lanes;
+                break;
+            case Opcode::Negate: {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(top - lanes));
+                _mm256_storeu_si256((__m256i *)(top - lanes), _mm256_sub_epi32(_mm256_setzero_si256(), x));
+                break;
+            }
+            case Opcode::Add:
+            case Opcode::Subtract:
+            case Opcode::Multiply: {
+                top -= lanes;
+                __m256i x = _mm256_loadu_si256((const __m256i *)(top - lanes));
+                __m256i y = _mm256_loadu_si256((const __m256i *)top);
+                __m256i r = in.op == Opcode::Add ? _mm256_add_epi32(x, y)
+                          : in.op == Opcode::Subtract ? _mm256_sub_epi32(x, y)
+                          : _mm256_mullo_epi32(x, y);
+                _mm256_storeu_si256((__m256i *)(top - lanes), r);
+                break;
+            }
+            case Opcode::Zero:
+                _mm256_storeu_si256((__m256i *)(top - lanes), _mm256_setzero_si256());
+                break;
+        }
+    }
+    _mm256_storeu_si256((__m256i *)(results + first), _mm256_loadu_si256((const __m256i *)(top - lanes)));
+}
+#endif
+
+void Program::eval_batch(const int *bindings, size_t count, int *results) const
+{
+    size_t k = 0;
+#if HAVE_X86_SIMD
+    if (cpuFeatures().avx2)
+        for (; k + lanes <= count; k += lanes)
+            eval_block_avx2(bindings, count, k, results);
+#endif
+    for (; k + lanes <= count; k += lanes)
+        eval_block(bindings, count, k, results);
+
+    // The last few one by one, through a table with just their variables filled in
+    int table[128] = { 0 };
+    for (; k < count; ++k) {
+        for (size_t s = 0; s < vars.size(); ++s)
+            table[int(vars[s])] = bindings[s * count + k];
+        results[k] = eval(table);
+    }
+}
+
+Tree::Tree(int n) { p = new IntNode(n); }
+Tree::Tree(char id) { p = new IdNode(id); }
+Tree::Tree(char op, Tree t) { p = new UnaryNode(op, t); }
+Tree::Tree(char op, Tree left, Tree right) { p = new BinaryNode(op, left, right); }
+
+NodeArena::~NodeArena()
+{
+    // Later nodes may refer to earlier ones, never the other way around
+    for (size_t i = all.size(); i-- > 0; )
+        all[i]->~Node();
+}
+
+void *NodeArena::allocate(size_t bytes)
+{
+    const size_t align = alignof(max_align_t);
+    bytes = (bytes + align - 1) / align * align;
+    if (used + bytes > chunk_size) {
+        chunks.emplace_back(new char[bytes > chunk_size ? bytes : size_t(chunk_size)]);
+        used = 0;
+    }
+    void *p = chunks.back().get() + used;
+    used += bytes;
+    return p;
+}
+
+template <class N, class... Args>
+Tree NodeArena::make(const Key &key, Args &&... args)
+{
+    if (hash_consing) {
+        auto known = table.find(key);
+        if (known != table.end())
+            return Tree(known->second);
+    }
+    void *memory = allocate(sizeof(N));
+    N *node = new (memory) N(std::forward<Args>(args)...);
+    node->in_arena = true;
+    all.push_back(node);
+    if (hash_consing)
+        table.emplace(key, node);
+    return Tree(node);
+}
+
+Tree NodeArena::constant(int n)
+{
+    Key key = { 'i', 0, n, nullptr, nullptr };
+    return make<IntNode>(key, n);
+}
+
+Tree NodeArena::variable(char id)
+{
+    Key key = { 'v', 0, id, nullptr, nullptr };
+    return make<IdNode>(key, id);
+}
+
+Tree NodeArena::unary(char op, Tree t)
+{
+    Key key = { 'u', op, 0, t.p, nullptr };
+    return make<UnaryNode>(key, op, t);
+}
+
+Tree NodeArena::binary(char op, Tree left, Tree right)
+{
+    Key key = { 'b', op, 0, left.p, right.p };
+    return make<BinaryNode>(key, op, left, right);
+}
+
+Tree balanced(int depth)
+{
+    if (depth == 0)
+        return Tree('+', Tree('-', 'B', 'A'), 1);
+    return Tree('+', balanced(depth - 1), balanced(depth - 1));
+}
+
+Tree balanced(NodeArena &arena, int depth)
+{
+    if (depth == 0)
+        return arena.binary('+', arena.binary('-', arena.variable('B'), arena.variable('A')), arena.constant(1));
+    return arena.binary('+', balanced(arena, depth - 1), balanced(arena, depth - 1));
+}
+
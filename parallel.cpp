@@ -0,0 +1,12 @@
+// parallel.cpp
+
+#include "parallel.h"
+#include "topology.h"
+
+ThreadPool &defaultPool()
+{
+    static ThreadPool pool(poolConfig().threads, ThreadPool::Mode::WorkStealing);
+    static const bool pinned = applyPinning(pool, poolConfig().pinning);
+    (void)pinned;
+    return pool;
+}
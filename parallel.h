@@ -0,0 +1,130 @@
+// parallel.h
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+#include "threadpool.h"
+
+// The half open index range [begin, end)
+struct Range {
+    size_t begin, end;
+    size_t size() const { return end > begin ? end - begin : 0; }
+};
+
+/*
+ The pool of the parallel algorithms when none is given: work-stealing, sized and pinned by
+ poolConfig() (CONCURRENT_THREADS, CONCURRENT_PINNING), started on the first call.
+ */
+ThreadPool &defaultPool();
+
+/*
+ Calls fn(begin, end) on pieces of range of at most grain indices, in parallel on pool, and
+ returns once all have been done. The range is split in halves, and each task queues one half
+ to its own deque for idle workers to steal while it splits the other, so the pieces spread
+ over the workers without one task per piece being queued up front. The calling thread runs
+ queued tasks while it waits, so a task may call parallel_for as well. The first exception fn
+ throws is thrown again once every piece is done.
+ */
+template<class F>
+void parallel_for(ThreadPool &pool, Range range, size_t grain, F fn);
+
+template<class F>
+void parallel_for(Range range, size_t grain, F fn) { parallel_for(defaultPool(), range, grain, fn); }
+
+/*
+ Reduces range to one value: map(begin, end) gives the value of a piece of at most grain
+ indices and combine(a, b) joins two values, starting from identity. The pieces are the same
+ for any number of workers and are combined from left to right, so floating point reductions
+ give the same result on any pool.
+ */
+template<class T, class Map, class Combine>
+T parallel_reduce(ThreadPool &pool, Range range, size_t grain, T identity, Map map, Combine combine);
+
+template<class T, class Map, class Combine>
+T parallel_reduce(Range range, size_t grain, T identity, Map map, Combine combine)
+{
+    return parallel_reduce(defaultPool(), range, grain, identity, map, combine);
+}
+
+namespace detail {
+
+template<class F>
+struct ParallelFor {
+    ThreadPool &pool;
+    F &fn;
+    const size_t grain;
+    std::atomic<size_t> remaining; // indices not done yet
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+
+    ParallelFor(ThreadPool &pool, F &fn, size_t grain, size_t size)
+        : pool(pool), fn(fn), grain(grain), remaining(size), failed(false) { }
+
+    void run(size_t begin, size_t end)
+    {
+        while (end - begin > grain) {
+            const size_t middle = begin + (end - begin) / 2;
+            try {
+                pool.enqueue([this, middle, end]() { run(middle, end); });
+            } catch (...) {
+                break; // shut down, the rest is done here
+            }
+            end = middle;
+        }
+        try {
+            fn(begin, end);
+        } catch (...) {
+            if (!failed.exchange(true))
+                error = std::current_exception();
+        }
+        // The last indices done release the caller, nothing here is touched after that
+        remaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+    }
+};
+
+} // namespace detail
+
+template<class F>
+void parallel_for(ThreadPool &pool, Range range, size_t grain, F fn)
+{
+    if (range.size() == 0) return;
+    grain = std::max<size_t>(1, grain);
+    if (range.size() <= grain || pool.size() == 0) {
+        fn(range.begin, range.end);
+        return;
+    }
+    detail::ParallelFor<F> loop(pool, fn, grain, range.size());
+    loop.run(range.begin, range.end);
+    while (loop.remaining.load(std::memory_order_acquire) > 0)
+        if (!pool.run_one())
+            std::this_thread::yield();
+    if (loop.failed)
+        std::rethrow_exception(loop.error);
+}
+
+template<class T, class Map, class Combine>
+T parallel_reduce(ThreadPool &pool, Range range, size_t grain, T identity, Map map, Combine combine)
+{
+    grain = std::max<size_t>(1, grain);
+    const size_t pieces = (range.size() + grain - 1) / grain;
+    struct Piece { T value; }; // not a vector<bool> when T is bool
+    std::vector<Piece> values(pieces, Piece{ identity });
+    parallel_for(pool, Range{ 0, pieces }, 1, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; ++p) {
+            const size_t begin = range.begin + p * grain;
+            values[p].value = map(begin, std::min(range.end, begin + grain));
+        }
+    });
+    T result = identity;
+    for (const Piece &p : values)
+        result = combine(result, p.value);
+    return result;
+}
+
+#endif // PARALLEL_H
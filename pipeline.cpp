@@ -0,0 +1,120 @@
+// pipeline.cpp
+// Mandelbrot zooms and Tree evaluation as coroutines on the pool, needs C++20
+// compile with: g++ -std=c++20 -pthread pipeline.cpp render.cpp deepzoom.cpp nodes.cpp topology.cpp
+//                   timing.cpp -o pipeline
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "async.h"
+#include "mandelbrot.h"
+#include "tree.h"
+#include "topology.h"
+#include "timing.h"
+
+// One tile, as a task of pool
+task<void> renderTile(const Frame &frame, PPMImage &image, int minX, int maxX, int minY, int maxY,
+                      ThreadPool &pool)
+{
+    co_await schedule(pool);
+    if (frame.job.shortcuts.borderTracing)
+        borderTrace(frame, minX, maxX, minY, maxY, image, 0);
+    else
+        mandelbrot(frame, minX, maxX, minY, maxY, image);
+}
+
+// Every tile of the frame at once, like renderTiles
+task<void> renderFrame(const Frame &frame, PPMImage &image, ThreadPool &pool)
+{
+    const RenderJob &job = frame.job;
+    std::vector<task<void>> tiles;
+    for (int minY = 0; minY < job.height; minY += job.tileSize)
+        for (int minX = 0; minX < job.width; minX += job.tileSize)
+            tiles.push_back(renderTile(frame, image, minX, std::min(minX + job.tileSize, job.width),
+                                       minY, std::min(minY + job.tileSize, job.height), pool));
+    co_await when_all(std::move(tiles));
+}
+
+/*
+ renderBatch as a pipeline: frame N is written on io while frame N+1 renders on pool, and no
+ worker of either waits for the other. Deep and streamed jobs are left to renderBatch.
+ */
+task<void> renderZoom(const std::vector<RenderJob> &jobs, ThreadPool &pool, ThreadPool &io)
+{
+    std::vector<std::unique_ptr<Palette>> palettes;
+    std::unique_ptr<PPMImage> images[2];
+    for (size_t f = 0; f <= jobs.size(); f++)
+    {
+        std::vector<task<void>> stages;
+        if (f < jobs.size())
+        {
+            const RenderJob &job = jobs[f];
+            if (palettes.empty() || job.palette != jobs[f - 1].palette || job.maxIterations != jobs[f - 1].maxIterations)
+                palettes.emplace_back(new Palette(job.palette->coloring, job.maxIterations, job.palette->steps));
+            std::unique_ptr<PPMImage> &image = images[f % 2];
+            if (!image || image->width() != size_t(job.width) || image->height() != size_t(job.height))
+                image.reset(new PPMImage(job.height, job.width));
+            stages.push_back([](const RenderJob &job, const Palette &palette, PPMImage &image, ThreadPool &pool) -> task<void> {
+                const Frame frame = { job, palette };
+                co_await renderFrame(frame, image, pool);
+            }(job, *palettes.back(), *image, pool));
+        }
+        if (f > 0)
+            stages.push_back(saveAsync(*images[(f - 1) % 2], jobs[f - 1].output, io, pool));
+        co_await when_all(std::move(stages));
+    }
+}
+
+// Tree::eval(pool, threshold) without a thread waiting for the left operand: it is awaited
+task<int> evalAsync(Tree tree, ThreadPool &pool, size_t threshold)
+{
+    if (tree.arity() == 0 || tree.size() < threshold)
+        co_return tree.eval();
+    if (tree.arity() == 1)
+        co_return tree.combine(co_await evalAsync(tree.operand(0), pool, threshold));
+
+    std::vector<task<int>> operands;
+    operands.push_back(on(pool, evalAsync(tree.operand(0), pool, threshold)));
+    operands.push_back(evalAsync(tree.operand(1), pool, threshold));
+    std::vector<int> values = co_await when_all(std::move(operands));
+    co_return tree.combine(values[0], values[1]);
+}
+
+// usage: pipeline [frames] [depth of the tree] [threshold]
+// the frames zoom in on -0.7436 + 0.1318i and go to pipeline0000.ppm, pipeline0001.ppm, ...
+int main(int argc, char *argv[])
+{
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 8;
+    const int depth = argc > 2 ? std::atoi(argv[2]) : 18;
+    const size_t threshold = argc > 3 ? std::atoi(argv[3]) : 10000;
+
+    ThreadPool pool(poolConfig().threads, ThreadPool::Mode::WorkStealing);
+    applyPinning(pool, poolConfig().pinning);
+    ThreadPool io(1); // file writes block, they get a worker of their own
+
+    RenderJob job = defaultJob();
+    job.output = "pipeline.ppm";
+    const std::vector<RenderJob> jobs = zoomSequence(job, -0.7436, 0.1318, 0.8, frames);
+    Stopwatch watch;
+    try {
+        sync_wait(renderZoom(jobs, pool, io));
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << frames << " frames rendered and written in " << watch.lap() << " seconds" << std::endl;
+
+    valtab['A'] = 3; valtab['B'] = 4;
+    Tree big = balanced(depth);
+    watch.restart();
+    int sequential = big.eval();
+    double first = watch.lap();
+    int awaited = sync_wait(evalAsync(big, pool, threshold));
+    double second = watch.lap();
+    std::cout << big.size() << " nodes: " << sequential << " in " << first << " seconds, " << awaited
+              << " in " << second << " seconds as coroutines on " << pool.size() << " workers" << std::endl;
+    return 0;
+}
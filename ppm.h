@@ -0,0 +1,148 @@
+// ppm.h
+
+#ifndef PPM_H
+#define PPM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+template <class T> struct RGB { T r, g, b; };
+
+/*
+ Matrix stored in one contiguous block that starts on a cache line. When a cache line holds a
+ whole number of elements, rows are padded to full cache lines as well; otherwise the rows are
+ packed back to back (stride() == width()), like the RGB pixels of a PPMImage.
+ */
+template <class T>
+class Matrix {
+public:
+    static const size_t alignment = 64;
+
+    Matrix(const size_t rows, const size_t cols) : _rows(rows), _cols(cols), _stride(rowStride(cols)) {
+        allocate();
+        for (size_t i = 0; i < _rows * _stride; ++i) {
+            new (_data + i) T;
+        }
+    }
+    Matrix(const Matrix &m) : _rows(m._rows), _cols(m._cols), _stride(m._stride) {
+        allocate();
+        std::uninitialized_copy(m._data, m._data + _rows * _stride, _data);
+    }
+    Matrix(Matrix &&m) noexcept : _rows(m._rows), _cols(m._cols), _stride(m._stride),
+                                  _buffer(m._buffer), _data(m._data) {
+        m._rows = m._cols = m._stride = 0;
+        m._buffer = nullptr;
+        m._data = nullptr;
+    }
+    Matrix &operator=(Matrix m) noexcept {
+        std::swap(_rows, m._rows);
+        std::swap(_cols, m._cols);
+        std::swap(_stride, m._stride);
+        std::swap(_buffer, m._buffer);
+        std::swap(_data, m._data);
+        return *this;
+    }
+    ~Matrix() {
+        for (size_t i = 0; i < _rows * _stride; ++i) {
+            _data[i].~T();
+        }
+        delete [] _buffer;
+    }
+    T *operator[] (const size_t nIndex)
+    {
+        return _data + nIndex * _stride;
+    }
+    const T *operator[] (const size_t nIndex) const
+    {
+        return _data + nIndex * _stride;
+    }
+    T *data() { return _data; }
+    const T *data() const { return _data; }
+    size_t width() const { return _cols; }
+    size_t height() const { return _rows; }
+    size_t stride() const { return _stride; } // elements from one row to the next
+protected:
+    size_t _rows, _cols, _stride;
+    char *_buffer; // _data aligned inside it
+    T *_data;
+private:
+    static size_t rowStride(size_t cols) {
+        if (alignment % sizeof(T) != 0)
+            return cols;
+        const size_t perLine = alignment / sizeof(T);
+        return (cols + perLine - 1) / perLine * perLine;
+    }
+    void allocate() {
+        _buffer = new char[_rows * _stride * sizeof(T) + alignment];
+        size_t offset = reinterpret_cast<uintptr_t>(_buffer) % alignment;
+        _data = reinterpret_cast<T *>(_buffer + (offset ? alignment - offset : 0));
+    }
+};
+
+static_assert(sizeof(RGB<unsigned char>) == 3, "PPM pixels are written straight from memory");
+
+// Portable PixMap image
+class PPMImage : public Matrix<RGB<unsigned char> >
+{
+public:
+    PPMImage(const size_t height, const size_t width) : Matrix(height, width) { }
+    void save(const std::string &filename) const
+    {
+        std::ofstream out(filename, std::ios_base::binary);
+        out << header(_cols, _rows);
+        writeRows(out, 0, _rows);
+    }
+    static std::string header(size_t width, size_t height)
+    {
+        return "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    }
+    // Writes rows first..first+count-1 in as few write calls as the row stride allows
+    void writeRows(std::ostream &out, size_t first, size_t count) const
+    {
+        if (_stride == _cols)
+        {
+            out.write(reinterpret_cast<const char *>((*this)[first]), count * _cols * 3);
+            return;
+        }
+        for (size_t y = first; y < first + count; y++)
+            out.write(reinterpret_cast<const char *>((*this)[y]), _cols * 3);
+    }
+};
+
+/*
+ Writes a PPM file band by band, so images can be rendered and written in row bands
+ without ever holding the whole image in memory. Bands are appended top to bottom.
+ */
+class PPMWriter
+{
+public:
+    PPMWriter(const std::string &filename, size_t width, size_t height)
+        : out(filename, std::ios_base::binary), width(width), height(height), rows(0)
+    {
+        if (!out)
+            throw std::runtime_error("cannot open " + filename);
+        out << PPMImage::header(width, height);
+    }
+    // Appends the first count rows of band
+    void write(const PPMImage &band, size_t count)
+    {
+        if (band.width() != width || rows + count > height)
+            throw std::runtime_error("band does not fit the image");
+        band.writeRows(out, 0, count);
+        rows += count;
+        if (!out)
+            throw std::runtime_error("write failed");
+    }
+    size_t rowsWritten() const { return rows; }
+private:
+    std::ofstream out;
+    size_t width, height, rows;
+};
+
+#endif // PPM_H
@@ -0,0 +1,711 @@
+// render.cpp
+// The Mandelbrot renderer behind mandelbrot.h: escape-time kernels, palettes and the tiled,
+// streaming and batch renderers
+
+#include <cctype>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "mandelbrot.h"
+#include "deepzoom.h"
+#include "cpu_features.h"
+#include "parallel.h"
+
+#if HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+int findMandelBrot(double cr, double ci, int max_iterations)
+{
+    int i = 0;
+    double zr = 0.0, zi = 0.0;
+    while(i < max_iterations && zr * zr + zi * zi < 4.0)
+    {
+        double temp = zr * zr - zi * zi + cr;
+        zi =2.0 * zr * zi + ci;
+        zr = temp;
+        i++;
+    }
+
+    if(i >= max_iterations)
+        return -1;
+    return i;
+}
+
+/*
+ Same as findMandelBrot, but also stores |z|^2 at the moment the point escaped in magnitude,
+ which smooth palettes use to interpolate between iteration counts
+ */
+int findMandelBrot(double cr, double ci, int max_iterations, double &magnitude)
+{
+    int i = 0;
+    double zr = 0.0, zi = 0.0;
+    while(i < max_iterations && (magnitude = zr * zr + zi * zi) < 4.0)
+    {
+        double temp = zr * zr - zi * zi + cr;
+        zi =2.0 * zr * zi + ci;
+        zr = temp;
+        i++;
+    }
+
+    if(i >= max_iterations)
+        return -1;
+    return i;
+}
+
+// The counts are kept as doubles in the vector registers
+static void storeCounts(const double *count, int lanes, int max_iterations, int *n)
+{
+    for (int k = 0; k < lanes; k++)
+        n[k] = count[k] >= max_iterations ? -1 : int(count[k]);
+}
+
+template <bool Smooth, bool Periodic>
+void findMandelBrotScalar(const double *cr, const double *ci, int max_iterations, int *n, double *magnitude)
+{
+    if (!Periodic)
+    {
+        if (Smooth)
+            n[0] = findMandelBrot(cr[0], ci[0], max_iterations, magnitude[0]);
+        else
+            n[0] = findMandelBrot(cr[0], ci[0], max_iterations);
+        return;
+    }
+
+    int i = 0, next = 1;
+    double zr = 0.0, zi = 0.0, sr = 0.0, si = 0.0, mag = 0.0;
+    while(i < max_iterations && (mag = zr * zr + zi * zi) < 4.0)
+    {
+        double temp = zr * zr - zi * zi + cr[0];
+        zi =2.0 * zr * zi + ci[0];
+        zr = temp;
+        i++;
+        if (zr == sr && zi == si)
+        {
+            n[0] = -1;
+            return;
+        }
+        if (i == next)
+        {
+            sr = zr;
+            si = zi;
+            next *= 2;
+        }
+    }
+    if (Smooth)
+        magnitude[0] = mag;
+    n[0] = i >= max_iterations ? -1 : i;
+}
+
+#if HAVE_X86_SIMD
+template <bool Smooth, bool Periodic>
+__attribute__((target("sse2")))
+void findMandelBrotSSE2(const double *cr, const double *ci, int max_iterations, int *n, double *magnitude)
+{
+    const __m128d four = _mm_set1_pd(4.0), two = _mm_set1_pd(2.0), one = _mm_set1_pd(1.0);
+    const __m128d vcr = _mm_loadu_pd(cr), vci = _mm_loadu_pd(ci);
+    __m128d zr = _mm_setzero_pd(), zi = _mm_setzero_pd(), count = _mm_setzero_pd();
+    __m128d escape = _mm_setzero_pd();
+    __m128d active = _mm_cmpeq_pd(zr, zr); // all ones
+    __m128d sr = zr, si = zi, limit = _mm_set1_pd(max_iterations);
+    int next = 1;
+    for (int i = 0; i < max_iterations; i++)
+    {
+        __m128d zr2 = _mm_mul_pd(zr, zr);
+        __m128d zi2 = _mm_mul_pd(zi, zi);
+        __m128d mag = _mm_add_pd(zr2, zi2);
+        __m128d stay = _mm_and_pd(active, _mm_cmplt_pd(mag, four));
+        if (Smooth)
+        {
+            __m128d escaped = _mm_andnot_pd(stay, active);
+            escape = _mm_or_pd(_mm_and_pd(escaped, mag), _mm_andnot_pd(escaped, escape));
+        }
+        active = stay;
+        if (_mm_movemask_pd(active) == 0) break;
+        count = _mm_add_pd(count, _mm_and_pd(active, one));
+        __m128d temp = _mm_add_pd(_mm_sub_pd(zr2, zi2), vcr);
+        zi = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, zr), zi), vci);
+        zr = temp;
+        if (Periodic)
+        {
+            __m128d cycle = _mm_and_pd(active, _mm_and_pd(_mm_cmpeq_pd(zr, sr), _mm_cmpeq_pd(zi, si)));
+            count = _mm_or_pd(_mm_and_pd(cycle, limit), _mm_andnot_pd(cycle, count));
+            active = _mm_andnot_pd(cycle, active);
+            if (i + 1 == next)
+            {
+                sr = zr;
+                si = zi;
+                next *= 2;
+            }
+        }
+    }
+    double c[2];
+    _mm_storeu_pd(c, count);
+    storeCounts(c, 2, max_iterations, n);
+    if (Smooth)
+        _mm_storeu_pd(magnitude, escape);
+}
+
+template <bool Smooth, bool Periodic>
+__attribute__((target("avx2")))
+void findMandelBrotAVX2(const double *cr, const double *ci, int max_iterations, int *n, double *magnitude)
+{
+    const __m256d four = _mm256_set1_pd(4.0), two = _mm256_set1_pd(2.0), one = _mm256_set1_pd(1.0);
+    const __m256d vcr = _mm256_loadu_pd(cr), vci = _mm256_loadu_pd(ci);
+    __m256d zr = _mm256_setzero_pd(), zi = _mm256_setzero_pd(), count = _mm256_setzero_pd();
+    __m256d escape = _mm256_setzero_pd();
+    __m256d active = _mm256_cmp_pd(zr, zr, _CMP_EQ_OQ); // all ones
+    __m256d sr = zr, si = zi, limit = _mm256_set1_pd(max_iterations);
+    int next = 1;
+    for (int i = 0; i < max_iterations; i++)
+    {
+        __m256d zr2 = _mm256_mul_pd(zr, zr);
+        __m256d zi2 = _mm256_mul_pd(zi, zi);
+        __m256d mag = _mm256_add_pd(zr2, zi2);
+        __m256d stay = _mm256_and_pd(active, _mm256_cmp_pd(mag, four, _CMP_LT_OQ));
+        if (Smooth)
+            escape = _mm256_blendv_pd(escape, mag, _mm256_andnot_pd(stay, active));
+        active = stay;
+        if (_mm256_movemask_pd(active) == 0) break;
+        count = _mm256_add_pd(count, _mm256_and_pd(active, one));
+        __m256d temp = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), vcr);
+        zi = _mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, zr), zi), vci);
+        zr = temp;
+        if (Periodic)
+        {
+            __m256d cycle = _mm256_and_pd(active, _mm256_and_pd(_mm256_cmp_pd(zr, sr, _CMP_EQ_OQ),
+                                                                 _mm256_cmp_pd(zi, si, _CMP_EQ_OQ)));
+            count = _mm256_blendv_pd(count, limit, cycle);
+            active = _mm256_andnot_pd(cycle, active);
+            if (i + 1 == next)
+            {
+                sr = zr;
+                si = zi;
+                next *= 2;
+            }
+        }
+    }
+    double c[4];
+    _mm256_storeu_pd(c, count);
+    storeCounts(c, 4, max_iterations, n);
+    if (Smooth)
+        _mm256_storeu_pd(magnitude, escape);
+}
+
+template <bool Smooth, bool Periodic>
+__attribute__((target("avx512f")))
+void findMandelBrotAVX512(const double *cr, const double *ci, int max_iterations, int *n, double *magnitude)
+{
+    const __m512d four = _mm512_set1_pd(4.0), two = _mm512_set1_pd(2.0), one = _mm512_set1_pd(1.0);
+    const __m512d vcr = _mm512_loadu_pd(cr), vci = _mm512_loadu_pd(ci);
+    __m512d zr = _mm512_setzero_pd(), zi = _mm512_setzero_pd(), count = _mm512_setzero_pd();
+    __m512d escape = _mm512_setzero_pd();
+    __mmask8 active = 0xFF;
+    __m512d sr = zr, si = zi, limit = _mm512_set1_pd(max_iterations);
+    int next = 1;
+    for (int i = 0; i < max_iterations; i++)
+    {
+        __m512d zr2 = _mm512_mul_pd(zr, zr);
+        __m512d zi2 = _mm512_mul_pd(zi, zi);
+        __m512d mag = _mm512_add_pd(zr2, zi2);
+        __mmask8 stay = active & _mm512_cmp_pd_mask(mag, four, _CMP_LT_OQ);
+        if (Smooth)
+            escape = _mm512_mask_mov_pd(escape, active & ~stay, mag);
+        active = stay;
+        if (active == 0) break;
+        count = _mm512_mask_add_pd(count, active, count, one);
+        __m512d temp = _mm512_add_pd(_mm512_sub_pd(zr2, zi2), vcr);
+        zi = _mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, zr), zi), vci);
+        zr = temp;
+        if (Periodic)
+        {
+            __mmask8 cycle = active & _mm512_cmp_pd_mask(zr, sr, _CMP_EQ_OQ)
+                                    & _mm512_cmp_pd_mask(zi, si, _CMP_EQ_OQ);
+            count = _mm512_mask_mov_pd(count, cycle, limit);
+            active &= ~cycle;
+            if (i + 1 == next)
+            {
+                sr = zr;
+                si = zi;
+                next *= 2;
+            }
+        }
+    }
+    double c[8];
+    _mm512_storeu_pd(c, count);
+    storeCounts(c, 8, max_iterations, n);
+    if (Smooth)
+        _mm512_storeu_pd(magnitude, escape);
+}
+#endif
+
+const EscapeKernel escapeKernels[] = {
+#if HAVE_X86_SIMD
+    { "avx512", 8, { findMandelBrotAVX512<false, false>, findMandelBrotAVX512<true, false>,
+                     findMandelBrotAVX512<false, true>, findMandelBrotAVX512<true, true> } },
+    { "avx2", 4, { findMandelBrotAVX2<false, false>, findMandelBrotAVX2<true, false>,
+                   findMandelBrotAVX2<false, true>, findMandelBrotAVX2<true, true> } },
+    { "sse2", 2, { findMandelBrotSSE2<false, false>, findMandelBrotSSE2<true, false>,
+                   findMandelBrotSSE2<false, true>, findMandelBrotSSE2<true, true> } },
+#endif
+    { "scalar", 1, { findMandelBrotScalar<false, false>, findMandelBrotScalar<true, false>,
+                     findMandelBrotScalar<false, true>, findMandelBrotScalar<true, true> } },
+};
+
+bool kernelSupported(const EscapeKernel &kernel)
+{
+    const std::string name = kernel.name;
+    if (name == "avx512") return cpuFeatures().avx512f;
+    if (name == "avx2") return cpuFeatures().avx2;
+    if (name == "sse2") return cpuFeatures().sse2;
+    return true;
+}
+
+/* Returns the kernel with the given name, or the widest one this CPU supports if name is empty.
+   Returns nullptr for unknown or unsupported kernels */
+const EscapeKernel *selectKernel(const std::string &name)
+{
+    for (const EscapeKernel &kernel : escapeKernels)
+        if ((name.empty() || name == kernel.name) && kernelSupported(kernel))
+            return &kernel;
+    return nullptr;
+}
+
+/* Function that retrieves the real number*/
+double mapToReal (int x, int width, double minR, double maxR)
+{
+    double range = maxR - minR;
+
+    return x * (range / width) + minR;
+}
+
+/* Function that retrieves the imaginary number*/
+double mapToImaginary(int y, int height, double minI, double maxI)
+{
+    double range = maxI - minI;
+
+    return y * (range / height) + minI;
+}
+
+/* Function that sets the color for each pixel, n is -1 for points inside the set */
+RGB<unsigned char> classicColor(double count, int)
+{
+    const int n = int(count);
+    int colors[3];
+
+    if(n == -1)
+    {
+        colors[0] = colors[1] = colors[2] = 0;
+    }
+    else if(n == 0)
+    {
+        colors[0] = 255;
+        colors[1] = colors[2] = 0;
+    }
+    else
+    {
+        if (n < 16) {
+            colors[0] = 16 * (16 - n);
+            colors[1] = 0;
+            colors[2] = 16 * n - 1;
+        } else if (n < 32) {
+            colors[0] = 0;
+            colors[1] = 16 * (n - 16);
+            colors[2] = 16 * (32 - n) - 1;
+        } else if (n < 64) {
+            colors[0] = 8 * (n - 32);
+            colors[1] = 8 * (64 - n) - 1;
+            colors[2] = 0;
+        } else { // range is 64 - 127
+            colors[0] = 255 - (n - 64) * 4;
+            colors[1] = colors[2] = 0;
+        }
+    }
+
+    RGB<unsigned char> color;
+    color.r = colors[0];
+    color.g = colors[1];
+    color.b = colors[2];
+    return color;
+}
+
+// Black inside the set and grey outside, the coloring that used to be the fast one
+RGB<unsigned char> flatColor(double n, int)
+{
+    unsigned char v = n < 0 ? 0 : 100;
+    RGB<unsigned char> color = { v, v, v };
+    return color;
+}
+
+// Cosine gradient over the fractional iteration count
+RGB<unsigned char> smoothColor(double n, int)
+{
+    RGB<unsigned char> color = { 0, 0, 0 };
+    if (n < 0)
+        return color;
+    const double t = 0.1 * n;
+    color.r = (unsigned char)(127.5 * (1.0 + std::cos(t + 3.0)));
+    color.g = (unsigned char)(127.5 * (1.0 + std::cos(t + 3.6)));
+    color.b = (unsigned char)(127.5 * (1.0 + std::cos(t + 4.2)));
+    return color;
+}
+
+const PaletteType paletteTypes[] = {
+    { "classic", classicColor, 1 },
+    { "flat", flatColor, 1 },
+    { "smooth", smoothColor, 16 },
+};
+
+const PaletteType *findPalette(const std::string &name)
+{
+    for (const PaletteType &type : paletteTypes)
+        if (name == type.name)
+            return &type;
+    return nullptr;
+}
+
+RenderJob defaultJob()
+{
+    RenderJob job;
+    job.view.minR = -2.0;
+    job.view.maxR = 0.7;
+    job.view.minI = -1.2;
+    job.view.maxI = 1.2;
+    job.width = 1600;
+    job.height = 1300;
+    job.maxIterations = 127;
+    job.palette = findPalette("classic");
+    job.kernel = selectKernel("");
+    job.shortcuts.interiorTest = false;
+    job.shortcuts.periodicity = false;
+    job.shortcuts.borderTracing = false;
+    job.deep.radius = 0;
+    job.tileSize = 32;
+    job.bandRows = 0;
+    job.output = "mandelbrot.ppm";
+    return job;
+}
+
+// True for points in the main cardioid or the period-2 bulb
+bool inCardioidOrBulb(double cr, double ci)
+{
+    double x = cr - 0.25;
+    double q = x * x + ci * ci;
+    if (q * (q + x) <= 0.25 * ci * ci)
+        return true;
+    return (cr + 1.0) * (cr + 1.0) + ci * ci <= 0.0625;
+}
+
+/*
+ Escape counts (and with a smooth palette |z|^2 at the escape) of count points, computed with
+ the kernel of the job one batch of lanes at a time. The spare lanes of the last batch repeat
+ its last point.
+ */
+void escapeCounts(const Frame &frame, const double *cr, const double *ci, int count, int *n,
+                  double *magnitude)
+{
+    const RenderJob &job = frame.job;
+    const int lanes = job.kernel->lanes;
+    const bool smooth = frame.palette.isSmooth();
+    const KernelFunction run = job.kernel->variant(smooth, job.shortcuts.periodicity);
+    double r[8], i[8], mag[8];
+    int m[8];
+
+    for (int j = 0; j < count; j += lanes)
+    {
+        int batch = std::min(lanes, count - j);
+        int inside = 0;
+        for (int k = 0; k < lanes; k++)
+        {
+            r[k] = cr[j + std::min(k, batch - 1)];
+            i[k] = ci[j + std::min(k, batch - 1)];
+        }
+        if (job.shortcuts.interiorTest)
+            for (int k = 0; k < batch; k++)
+                if (inCardioidOrBulb(r[k], i[k]))
+                    inside++;
+
+        if (inside < batch)
+            run(r, i, job.maxIterations, m, mag);
+        for (int k = 0; k < batch; k++)
+        {
+            n[j + k] = inside == batch ? -1 : m[k];
+            if (smooth)
+                magnitude[j + k] = mag[k];
+        }
+        if (job.shortcuts.interiorTest && 0 < inside && inside < batch)
+            for (int k = 0; k < batch; k++)
+                if (inCardioidOrBulb(r[k], i[k]))
+                    n[j + k] = -1;
+    }
+}
+
+/* This function sets the needed variables for the mandelbrot aswell as calculating and drawing it
+   for the pixels in columns minX..maxX-1 and rows minY..maxY-1. Row firstRow of the picture
+   is row 0 of image, so image can hold a band of a taller picture */
+void mandelbrot(const Frame &frame, int minX, int maxX, int minY, int maxY, PPMImage &image,
+                int firstRow){
+    const RenderJob &job = frame.job;
+    const Palette &palette = frame.palette;
+    const int count = maxX - minX;
+    const bool smooth = palette.isSmooth();
+    std::vector<double> cr(count), ci(count), magnitude(count);
+    std::vector<int> n(count);
+
+    for (int j = 0; j < count; j++)
+        cr[j] = mapToReal(minX + j, job.width, job.view.minR, job.view.maxR);
+
+    for (int i = minY; i < maxY; i++) //Rows
+    {
+        std::fill(ci.begin(), ci.end(), mapToImaginary(i, job.height, job.view.minI, job.view.maxI));
+        escapeCounts(frame, cr.data(), ci.data(), count, n.data(), magnitude.data());
+
+        RGB<unsigned char> *row = image[i - firstRow] + minX;
+        if (smooth)
+            for (int j = 0; j < count; j++)
+                row[j] = palette.smooth(n[j], magnitude[j]);
+        else
+            for (int j = 0; j < count; j++)
+                row[j] = palette[n[j]];
+    }
+}
+
+/*
+ Mariani-Silver subdivision of the rectangle minX..maxX-1 x minY..maxY-1: compute and draw its
+ border, fill the inside with the border color when every border pixel has the same count,
+ otherwise split the inside into four and repeat. Small rectangles are rendered pixel by pixel.
+ */
+void borderTrace(const Frame &frame, int minX, int maxX, int minY, int maxY, PPMImage &image,
+                 int firstRow)
+{
+    const RenderJob &job = frame.job;
+    const Palette &palette = frame.palette;
+    const int w = maxX - minX, h = maxY - minY;
+    if (w < 8 || h < 8)
+    {
+        if (w > 0 && h > 0)
+            mandelbrot(frame, minX, maxX, minY, maxY, image, firstRow);
+        return;
+    }
+
+    // The border clockwise from the top left corner
+    const int count = 2 * (w + h) - 4;
+    const bool smooth = palette.isSmooth();
+    std::vector<double> cr(count), ci(count), magnitude(count);
+    std::vector<int> n(count), xs(count), ys(count);
+    int k = 0;
+    for (int x = minX; x < maxX; x++, k++) { xs[k] = x; ys[k] = minY; }
+    for (int y = minY + 1; y < maxY; y++, k++) { xs[k] = maxX - 1; ys[k] = y; }
+    for (int x = maxX - 2; x >= minX; x--, k++) { xs[k] = x; ys[k] = maxY - 1; }
+    for (int y = maxY - 2; y > minY; y--, k++) { xs[k] = minX; ys[k] = y; }
+    for (k = 0; k < count; k++)
+    {
+        cr[k] = mapToReal(xs[k], job.width, job.view.minR, job.view.maxR);
+        ci[k] = mapToImaginary(ys[k], job.height, job.view.minI, job.view.maxI);
+    }
+    escapeCounts(frame, cr.data(), ci.data(), count, n.data(), magnitude.data());
+
+    bool uniform = true;
+    for (k = 0; k < count; k++)
+    {
+        image[ys[k] - firstRow][xs[k]] = smooth ? palette.smooth(n[k], magnitude[k]) : palette[n[k]];
+        uniform = uniform && n[k] == n[0];
+    }
+
+    if (uniform && (!smooth || n[0] == -1))
+    {
+        const RGB<unsigned char> color = palette[n[0]];
+        for (int y = minY + 1; y < maxY - 1; y++)
+            std::fill(image[y - firstRow] + minX + 1, image[y - firstRow] + maxX - 1, color);
+        return;
+    }
+
+    const int midX = (minX + 1 + maxX - 1) / 2, midY = (minY + 1 + maxY - 1) / 2;
+    borderTrace(frame, minX + 1, midX, minY + 1, midY, image, firstRow);
+    borderTrace(frame, midX, maxX - 1, minY + 1, midY, image, firstRow);
+    borderTrace(frame, minX + 1, midX, midY, maxY - 1, image, firstRow);
+    borderTrace(frame, midX, maxX - 1, midY, maxY - 1, image, firstRow);
+}
+
+/*
+ Renders rows firstRow..firstRow+rows-1 of the picture into image, in square tiles of
+ job.tileSize pixels. Each worker of the pool keeps taking the next tile from a shared counter
+ until none are left, so the workers that get the cheap tiles outside the set simply render
+ more of them. Tiles on the right and bottom edge are cut to the picture size.
+ */
+void renderTiles(const Frame &frame, PPMImage &image, int firstRow, int rows, ThreadPool &pool)
+{
+    const RenderJob &job = frame.job;
+    const int tileSize = job.tileSize;
+    const int width = job.width;
+    const int lastRow = firstRow + rows;
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (rows + tileSize - 1) / tileSize;
+    const int tiles = tilesX * tilesY;
+
+    // Tiles differ a lot in cost: eight pieces per worker leave enough to steal to even them out
+    const size_t grain = std::max<size_t>(1, size_t(tiles) / (8 * pool.size()));
+    parallel_for(pool, Range{ 0, size_t(tiles) }, grain, [&](size_t first, size_t last)
+    {
+        for (int t = int(first); t < int(last); t++)
+        {
+            int minX = (t % tilesX) * tileSize;
+            int minY = firstRow + (t / tilesX) * tileSize;
+            int maxX = std::min(minX + tileSize, width);
+            int maxY = std::min(minY + tileSize, lastRow);
+            if (job.shortcuts.borderTracing)
+                borderTrace(frame, minX, maxX, minY, maxY, image, firstRow);
+            else
+                mandelbrot(frame, minX, maxX, minY, maxY, image, firstRow);
+        }
+    });
+}
+
+// Renders the whole image
+void renderTiles(const Frame &frame, PPMImage &image, ThreadPool &pool)
+{
+    renderTiles(frame, image, 0, frame.job.height, pool);
+}
+
+// Waits for a pool task on every way out of a scope, also by an exception, as the task uses its locals
+struct WaitOnExit {
+    std::future<void> &task;
+    ~WaitOnExit()
+    {
+        if (task.valid())
+            task.wait();
+    }
+};
+
+/*
+ Renders the picture straight to job.output, job.bandRows rows at a time. There are two band
+ buffers: while the pool renders the next band into one, a pool task writes the finished band
+ from the other, so only two bands are ever in memory.
+ */
+void renderStreaming(const Frame &frame, ThreadPool &pool)
+{
+    const RenderJob &job = frame.job;
+    PPMWriter writer(job.output, job.width, job.height);
+    PPMImage bands[2] = { PPMImage(job.bandRows, job.width), PPMImage(job.bandRows, job.width) };
+    std::future<void> writing;
+    WaitOnExit written = { writing };
+
+    for (int first = 0, b = 0; first < job.height; first += job.bandRows, b ^= 1)
+    {
+        int rows = std::min(job.bandRows, job.height - first);
+        renderTiles(frame, bands[b], first, rows, pool);
+
+        // The other buffer was written out while this band rendered
+        if (writing.valid())
+            writing.get();
+        PPMImage &band = bands[b];
+        writing = pool.submit([&writer, &band, rows]() { writer.write(band, rows); });
+    }
+    if (writing.valid())
+        writing.get();
+}
+
+void renderJob(const RenderJob &job, ThreadPool &pool)
+{
+    renderBatch(std::vector<RenderJob>(1, job), pool);
+}
+
+void renderBatch(const std::vector<RenderJob> &jobs, ThreadPool &pool)
+{
+    std::unique_ptr<Palette> palette;
+    const PaletteType *paletteType = nullptr;
+    int paletteIterations = 0;
+    std::unique_ptr<PPMImage> images[2];
+    std::future<void> saving;
+    WaitOnExit saved = { saving };
+
+    for (size_t f = 0, b = 0; f < jobs.size(); f++)
+    {
+        const RenderJob &job = jobs[f];
+        if (!palette || job.palette != paletteType || job.maxIterations != paletteIterations)
+        {
+            palette.reset(new Palette(job.palette->coloring, job.maxIterations, job.palette->steps));
+            paletteType = job.palette;
+            paletteIterations = job.maxIterations;
+        }
+        const Frame frame = { job, *palette };
+
+        if (job.bandRows > 0 && job.deep.radius == 0)
+        {
+            // Streams its own bands, and writes into its own file
+            renderStreaming(frame, pool);
+            continue;
+        }
+
+        // The save still running reads the other buffer, this one is free
+        std::unique_ptr<PPMImage> &image = images[b];
+        if (!image || image->width() != size_t(job.width) || image->height() != size_t(job.height))
+            image.reset(new PPMImage(job.height, job.width));
+        if (job.deep.radius > 0)
+            renderDeep(frame, *image, pool);
+        else
+            renderTiles(frame, *image, pool);
+
+        if (saving.valid())
+            saving.get();
+        PPMImage &done = *image;
+        const std::string output = job.output;
+        saving = pool.submit([&done, output]() { done.save(output); });
+        b ^= 1;
+    }
+    if (saving.valid())
+        saving.get();
+}
+
+std::vector<RenderJob> zoomSequence(const RenderJob &start, double centerR, double centerI,
+                                    double factor, int frames)
+{
+    // The name around the one %d or %0Nd in it, or around a four digit number before the extension
+    const std::string &pattern = start.output;
+    std::string prefix, suffix;
+    size_t digits = 4;
+    const size_t percent = pattern.find('%');
+    if (percent == std::string::npos)
+    {
+        size_t dot = pattern.rfind('.');
+        if (dot == std::string::npos)
+            dot = pattern.size();
+        prefix = pattern.substr(0, dot);
+        suffix = pattern.substr(dot);
+    }
+    else
+    {
+        size_t end = percent + 1;
+        digits = 0;
+        if (end < pattern.size() && pattern[end] == '0')
+        {
+            while (++end < pattern.size() && std::isdigit((unsigned char)pattern[end]))
+                digits = digits * 10 + (pattern[end] - '0');
+            if (digits == 0 || digits > 32)
+                throw std::invalid_argument("the frame number in " + pattern + " must be %d or %0Nd, N from 1 to 32");
+        }
+        if (end >= pattern.size() || pattern[end] != 'd' || pattern.find('%', end) != std::string::npos)
+            throw std::invalid_argument("the output " + pattern + " may only hold one %d or %0Nd, for the frame number");
+        prefix = pattern.substr(0, percent);
+        suffix = pattern.substr(end + 1);
+    }
+
+    std::vector<RenderJob> jobs;
+    double scale = 1.0;
+    for (int k = 0; k < frames; k++, scale *= factor)
+    {
+        RenderJob job = start;
+        job.view.minR = centerR + (start.view.minR - centerR) * scale;
+        job.view.maxR = centerR + (start.view.maxR - centerR) * scale;
+        job.view.minI = centerI + (start.view.minI - centerI) * scale;
+        job.view.maxI = centerI + (start.view.maxI - centerI) * scale;
+        job.deep.radius = start.deep.radius * scale;
+        std::string number = std::to_string(k);
+        if (number.size() < digits)
+            number.insert(0, digits - number.size(), '0');
+        job.output = prefix + number + suffix;
+        jobs.push_back(job);
+    }
+    return jobs;
+}
@@ -0,0 +1,297 @@
+// task.h
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Fixed-size block allocator for task captures that do not fit inline.
+ * Blocks are carved from large chunks and never return to the system.
+ * Every thread keeps a small cache of free blocks; a cache that overflows
+ * hands half of it to a shared depot, and an empty cache refills from it,
+ * so blocks freed by workers find their way back to the producers.
+ */
+class TaskSlab {
+public:
+    static const size_t block_size = 256;
+
+    static void *allocate();
+    static void deallocate(void *p);
+private:
+    struct Block { Block *next; };
+
+    static const size_t batch = 64; // blocks moved between a cache and the depot at once
+
+    struct Depot {
+        std::mutex mutex;
+        std::vector<Block *> batches; // each a list of batch blocks
+    };
+
+    struct Cache {
+        Block *head = nullptr;
+        size_t count = 0;
+        ~Cache();
+    };
+
+    static Depot &depot();
+    static Cache &cache();
+    static Block *refill();
+};
+
+inline TaskSlab::Depot &TaskSlab::depot()
+{
+    static Depot *d = new Depot; // outlives every thread's cache
+    return *d;
+}
+
+inline TaskSlab::Cache &TaskSlab::cache()
+{
+    static thread_local Cache c;
+    return c;
+}
+
+inline TaskSlab::Cache::~Cache()
+{
+    // Hand the cached blocks back in batch-sized lists
+    while (head != nullptr)
+    {
+        Block *list = head;
+        Block *tail = head;
+        for (size_t i = 1; i < batch && tail->next != nullptr; ++i)
+            tail = tail->next;
+        head = tail->next;
+        tail->next = nullptr;
+        Depot &d = depot();
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.batches.push_back(list);
+    }
+}
+
+// Get a batch of free blocks from the depot, or carve a new chunk
+inline TaskSlab::Block *TaskSlab::refill()
+{
+    Depot &d = depot();
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        if (!d.batches.empty())
+        {
+            Block *list = d.batches.back();
+            d.batches.pop_back();
+            return list;
+        }
+    }
+    char *chunk = static_cast<char *>(::operator new(batch * block_size));
+    Block *list = nullptr;
+    for (size_t i = batch; i-- > 0; )
+    {
+        Block *b = reinterpret_cast<Block *>(chunk + i * block_size);
+        b->next = list;
+        list = b;
+    }
+    return list;
+}
+
+inline void *TaskSlab::allocate()
+{
+    Cache &c = cache();
+    if (c.head == nullptr)
+    {
+        c.head = refill();
+        c.count = 0;
+        for (Block *b = c.head; b != nullptr; b = b->next)
+            ++c.count;
+    }
+    Block *b = c.head;
+    c.head = b->next;
+    --c.count;
+    return b;
+}
+
+inline void TaskSlab::deallocate(void *p)
+{
+    Cache &c = cache();
+    Block *b = static_cast<Block *>(p);
+    b->next = c.head;
+    c.head = b;
+    if (++c.count < 2 * batch) return;
+
+    // Give the oldest batch blocks back to the depot
+    Block *tail = c.head;
+    for (size_t i = 1; i < batch; ++i)
+        tail = tail->next;
+    Block *list = tail->next;
+    tail->next = nullptr;
+    c.count = batch;
+    Depot &d = depot();
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.batches.push_back(list);
+}
+
+/*
+ * Move-only replacement for std::function<void()> in the pool queues.
+ * Callables up to inline_size bytes that can be moved without throwing
+ * live inside the Task itself, bigger ones go to a TaskSlab block and
+ * only captures beyond TaskSlab::block_size fall back to operator new.
+ */
+class Task {
+public:
+    static const size_t inline_size = 48;
+
+    Task() noexcept : ops(nullptr) { }
+    Task(std::nullptr_t) noexcept : ops(nullptr) { }
+    template<class F, class = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&f);
+    Task(Task &&other) noexcept;
+    Task &operator=(Task &&other) noexcept;
+    Task &operator=(std::nullptr_t) noexcept { reset(); return *this; }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() { reset(); }
+
+    explicit operator bool() const { return ops != nullptr; }
+    void operator()() { ops->invoke(storage()); }
+private:
+    struct Ops {
+        void (*invoke)(void *);
+        void (*move)(void *to, void *from); // move-construct into to, destroy from
+        void (*destroy)(void *);
+    };
+
+    template<class F> struct Inline;
+    template<class F> struct Slab;
+    template<class F> struct Heap;
+
+    template<class F> struct fits_inline : std::integral_constant<bool,
+            sizeof(F) <= inline_size &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value> { };
+
+    template<class F> void init(F &&f, std::true_type);
+    template<class F> void init(F &&f, std::false_type);
+
+    void *storage() { return &buffer; }
+    void reset() noexcept;
+
+    typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type buffer;
+    const Ops *ops;
+};
+
+template<class F>
+struct Task::Inline {
+    static void invoke(void *p) { (*static_cast<F *>(p))(); }
+    static void move(void *to, void *from)
+    {
+        new (to) F(std::move(*static_cast<F *>(from)));
+        static_cast<F *>(from)->~F();
+    }
+    static void destroy(void *p) { static_cast<F *>(p)->~F(); }
+    static const Ops ops;
+};
+
+template<class F>
+const Task::Ops Task::Inline<F>::ops = { &invoke, &move, &destroy };
+
+// Slab and Heap keep a pointer to the callable in the buffer
+template<class F>
+struct Task::Slab {
+    static F *&target(void *p) { return *static_cast<F **>(p); }
+    static void invoke(void *p) { (*target(p))(); }
+    static void move(void *to, void *from) { new (to) F *(target(from)); }
+    static void destroy(void *p)
+    {
+        target(p)->~F();
+        TaskSlab::deallocate(target(p));
+    }
+    static const Ops ops;
+};
+
+template<class F>
+const Task::Ops Task::Slab<F>::ops = { &invoke, &move, &destroy };
+
+template<class F>
+struct Task::Heap {
+    static F *&target(void *p) { return *static_cast<F **>(p); }
+    static void invoke(void *p) { (*target(p))(); }
+    static void move(void *to, void *from) { new (to) F *(target(from)); }
+    static void destroy(void *p) { delete target(p); }
+    static const Ops ops;
+};
+
+template<class F>
+const Task::Ops Task::Heap<F>::ops = { &invoke, &move, &destroy };
+
+template<class F, class>
+Task::Task(F &&f) : ops(nullptr)
+{
+    using T = typename std::decay<F>::type;
+    init(std::forward<F>(f), fits_inline<T>());
+}
+
+template<class F>
+void Task::init(F &&f, std::true_type)
+{
+    using T = typename std::decay<F>::type;
+    new (storage()) T(std::forward<F>(f));
+    ops = &Inline<T>::ops;
+}
+
+template<class F>
+void Task::init(F &&f, std::false_type)
+{
+    using T = typename std::decay<F>::type;
+    if (sizeof(T) <= TaskSlab::block_size && alignof(T) <= alignof(std::max_align_t))
+    {
+        void *block = TaskSlab::allocate();
+        try {
+            new (storage()) T *(new (block) T(std::forward<F>(f)));
+        } catch (...) {
+            TaskSlab::deallocate(block);
+            throw;
+        }
+        ops = &Slab<T>::ops;
+    }
+    else
+    {
+        new (storage()) T *(new T(std::forward<F>(f)));
+        ops = &Heap<T>::ops;
+    }
+}
+
+inline Task::Task(Task &&other) noexcept : ops(other.ops)
+{
+    if (ops != nullptr)
+        ops->move(storage(), other.storage());
+    other.ops = nullptr;
+}
+
+inline Task &Task::operator=(Task &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        ops = other.ops;
+        if (ops != nullptr)
+            ops->move(storage(), other.storage());
+        other.ops = nullptr;
+    }
+    return *this;
+}
+
+inline void Task::reset() noexcept
+{
+    if (ops != nullptr)
+    {
+        ops->destroy(storage());
+        ops = nullptr;
+    }
+}
+
+#endif // TASK_H
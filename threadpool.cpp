@@ -1,88 +1,76 @@
 // threadpool.cpp
 // Compile with:
-// g++ -std=c++11 -pthread threadpool.cpp -o threadpool
+// g++ -std=c++11 -pthread threadpool.cpp topology.cpp parallel.cpp -o threadpool
 
-#include <thread>
-#include <mutex>
 #include <iostream>
-#include <vector>
-#include <deque>
+#include <numeric>
+#include "threadpool.h"
+#include "topology.h"
+#include "parallel.h"
 
-class ThreadPool; // forward declare
-
-class Worker {
-public:
-    Worker(ThreadPool &s): pool(s) { }
-    void operator()();
-private:
-    ThreadPool &pool;
-};
-
-class ThreadPool {
-public:
-    ThreadPool(size_t threads);
-    template<class F> void enqueue(F f);
-    ~ThreadPool();
-private:
-    friend class Worker;
-
-    std::vector<std::thread> workers;
-    std::deque<std::function<void()>> tasks;
-
-    std::condition_variable cond;
-
-    std::mutex queue_mutex;
-    bool stop;
-};
-
-void Worker::operator()()
-{
-    std::function<void()> task;
-    while (true)
-    {
-        std::unique_lock<std::mutex> locker(pool.queue_mutex);
-        pool.cond.wait(locker, [&]() { return !pool.tasks.empty() || pool.stop;});
-        if (pool.stop) return;
-        task = pool.tasks.front();
-        pool.tasks.pop_front();
-        locker.unlock();
-        task();
-    }
-}
-
-ThreadPool::ThreadPool(size_t threads): stop(false)
-{
-    for (size_t i = 0; i < threads; ++i)
-        workers.push_back(std::thread(Worker(*this)));
-}
-
-ThreadPool::~ThreadPool()
-{
-    stop = true; // stop all threads
-    cond.notify_all();
-    for (auto &thread: workers)
-        thread.join();
-}
-
-template<class F>
-void ThreadPool::enqueue(F f)
-{
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    tasks.push_back(std::function<void()>(f));
-    cond.notify_one();
-}
+int square(int x) { return x * x; }
 
 int main()
 {
-    ThreadPool pool(4);
+    // as many workers as CONCURRENT_THREADS says or one per CPU, pinned by CONCURRENT_PINNING
+    const Topology &topology = Topology::detect();
+    std::cout << topology.cpus().size() << " CPUs on " << topology.cores() << " cores and "
+              << topology.nodes() << " nodes" << std::endl;
+    ThreadPool pool(poolConfig().threads, ThreadPool::Mode::WorkStealing);
+    if (!applyPinning(pool, poolConfig().pinning))
+        std::cerr << "could not pin the workers" << std::endl;
 
     // queue a bunch of "work items"
     for (int i = 0; i < 8; ++i)
         pool.enqueue([i]() { std::cout << "Hello from work item " << i << std::endl; });
 
-    // wait for keypress to give worker threads the opportunity to finish tasks
-    std::cin.ignore();
+    // wait until the worker threads have finished all tasks
+    pool.wait_idle();
+
+    // submit returns a future with the result of the task
+    std::vector<std::future<int>> squares;
+    for (int i = 0; i < 8; ++i)
+        squares.push_back(pool.submit(square, i));
+    for (auto &f : squares)
+        std::cout << f.get() << " ";
+    std::cout << std::endl;
+
+    // a task that runs once a whole group of tasks has finished
+    std::atomic<int> sum(0);
+    TaskGroup group(pool);
+    for (int i = 1; i <= 100; ++i)
+        group.submit([&sum, i]() { sum += i; });
+    std::future<int> total = group.then([&sum]() { return sum.load(); });
+    std::cout << "Sum of 1..100 = " << total.get() << std::endl;
+
+    // loops over a range in pieces of at most 64 indices
+    std::vector<int> cubes(1000);
+    parallel_for(pool, Range{ 0, cubes.size() }, 64, [&cubes](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            cubes[i] = int(i * i * i % 1000);
+    });
+    long long cubeSum = parallel_reduce(pool, Range{ 0, cubes.size() }, 64, 0LL,
+        [&cubes](size_t begin, size_t end) { return std::accumulate(cubes.begin() + begin, cubes.begin() + end, 0LL); },
+        [](long long a, long long b) { return a + b; });
+    std::cout << "Sum of i^3 mod 1000 for i < 1000 = " << cubeSum << std::endl;
+
+    // with -DTHREADPOOL_STATS=1: what every worker did, and a trace of a burst of tasks
+    pool.trace(true);
+    for (int i = 0; i < 1000; ++i)
+        pool.enqueue([]() { std::this_thread::sleep_for(std::chrono::microseconds(20)); });
+    pool.wait_idle();
+    PoolStats stats = pool.stats();
+    if (stats.enabled) {
+        for (size_t i = 0; i < stats.threads.size(); ++i) {
+            const PoolStats::Thread &t = stats.threads[i];
+            std::cout << (i < pool.size() ? "worker " + std::to_string(i) : std::string("outside")) << ": "
+                      << t.enqueued << " enqueued, " << t.executed << " executed, " << t.stolen << " stolen, "
+                      << t.running << " s running, " << t.waiting << " s waiting" << std::endl;
+        }
+        std::cout << "at most " << stats.max_queue_depth << " tasks queued" << std::endl;
+        if (pool.write_trace("threadpool.trace.json"))
+            std::cout << "trace written to threadpool.trace.json" << std::endl;
+    }
 
     return 0;
 }
-
@@ -0,0 +1,853 @@
+// threadpool.h
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <type_traits>
+#include <vector>
+#include <deque>
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include "task.h"
+
+// Build with -DTHREADPOOL_STATS=1 to count and time what the pool does; without it the
+// counters are not compiled in at all and stats() reports enabled == false
+#ifndef THREADPOOL_STATS
+#define THREADPOOL_STATS 0
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class ThreadPool; // forward declare
+
+// What a ThreadPool did since it started, see ThreadPool::stats()
+struct PoolStats {
+    struct Thread {
+        uint64_t enqueued;  // tasks queued by this thread
+        uint64_t executed;  // tasks run by this thread
+        uint64_t stolen;    // of those, taken from the deque of another worker
+        double waiting;     // seconds parked waiting for a task
+        double running;     // seconds running tasks
+    };
+    bool enabled;
+    std::vector<Thread> threads;   // one per worker, the last one for all threads outside the pool
+    size_t max_queue_depth;        // most tasks queued at once, not counting pinned ones
+    std::array<uint64_t, 40> run_time; // tasks by run time, bucket b for 2^b up to 2^(b+1) nanoseconds
+};
+
+class Worker {
+public:
+    Worker(ThreadPool &s, size_t i): pool(s), index(i) { }
+    void operator()();
+private:
+    void run_shared();
+    void run_stealing();
+
+    ThreadPool &pool;
+    size_t index;
+};
+
+class ThreadPool {
+public:
+    /*
+     * SharedQueue: every worker takes tasks from one deque behind queue_mutex.
+     * WorkStealing: every worker owns a deque, pushes and pops at the back and
+     * steals from the front of the other deques when its own runs dry.
+     */
+    enum class Mode { SharedQueue, WorkStealing };
+
+    /*
+     * Drain: refuse new tasks from outside, run everything already queued, then stop.
+     * Cancel: refuse new tasks and drop everything not yet started; the futures
+     * of dropped tasks report std::future_errc::broken_promise.
+     */
+    enum class Shutdown { Drain, Cancel };
+
+    // capacity bounds the number of queued tasks, 0 means unbounded
+    ThreadPool(size_t threads, Mode mode = Mode::SharedQueue, size_t capacity = 0);
+    template<class F> void enqueue(F f); // blocks while full, throws once shut down
+    template<class F> bool try_enqueue(F f); // false when full or shut down
+    template<class F, class... Args>
+    auto submit(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    /*
+     * Run a task on one particular worker. These tasks wait in a queue of
+     * that worker that nobody steals from, are not held to the capacity and
+     * are refused as soon as shutdown starts, from inside the pool as well.
+     */
+    template<class F> void enqueue_to(size_t worker, F f); // throws once shut down
+    template<class F, class... Args>
+    auto submit_to(size_t worker, F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    // Pin worker i to the i-th CPU this process may run on; false where unsupported
+    bool pin_workers();
+    // Pin worker i to cpus[i % cpus.size()]; false if a pin failed or where unsupported
+    bool pin_workers(const std::vector<int> &cpus);
+    void wait_idle(); // block until every enqueued task has finished; not from a worker
+    /*
+     * Run one queued task on the calling thread, false if there was none.
+     * A task waiting for a task it spawned can help with this instead of
+     * blocking its worker, which could otherwise leave every worker waiting.
+     */
+    bool run_one();
+    void shutdown(Shutdown policy = Shutdown::Drain); // not from a worker
+    size_t size() const { return workers.size(); }
+    // Counters so far; the counters of different threads are read one after the other
+    PoolStats stats() const;
+    /*
+     * With trace on, every task and every wait of a worker is recorded as an event.
+     * write_trace saves them in the Chrome trace format (chrome://tracing, Perfetto)
+     * and is for an idle pool, like after wait_idle(). Both do nothing, and
+     * write_trace returns false, without THREADPOOL_STATS.
+     */
+    void trace(bool on);
+    bool write_trace(const std::string &path) const;
+    ~ThreadPool(); // drains
+private:
+    friend class Worker;
+    friend class TaskGroup;
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::deque<Task> pinned; // for this worker only, never stolen
+        std::atomic<size_t> pinned_count;
+        WorkQueue(): pinned_count(0) { }
+    };
+
+    bool push(Task task, bool block);
+    bool push_to(size_t worker, Task task);
+    bool pop_pinned(size_t index, Task &task);
+    bool reserve(bool block);
+    void release();
+    bool pop(size_t index, Task &task);
+    bool steal(size_t index, Task &task);
+    void run_task(Task &task, size_t index);
+    void finish_task(size_t n = 1);
+    size_t current_worker() const;
+    static const ThreadPool *&current_pool();
+    static size_t &current_index();
+
+    std::vector<std::thread> workers;
+    std::deque<Task> tasks;
+
+    // one per worker; the tasks deques are used in work-stealing mode only
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::atomic<size_t> pending; // tasks in the per-worker deques, counted before the push
+    std::atomic<size_t> idle; // workers parked on cond
+    std::atomic<size_t> blocked; // producers parked on space
+    std::atomic<size_t> next_queue; // round-robin target for outside producers
+
+    std::condition_variable cond;
+    std::condition_variable space; // signalled when a full queue drops below capacity
+
+    std::mutex queue_mutex;
+
+    std::atomic<size_t> unfinished; // enqueued but not yet finished
+    std::condition_variable idle_cond;
+    std::mutex idle_mutex;
+
+    const size_t capacity;
+    std::atomic<bool> stop;
+    std::atomic<bool> cancelled;
+    Mode mode;
+
+#if THREADPOOL_STATS
+    struct TraceEvent {
+        bool task; // a task ran, or the worker waited
+        uint64_t start, duration; // nanoseconds since the pool started
+    };
+
+    // Written by one thread, apart from the slot of outside threads; the padding
+    // keeps the counters of two slots off each other's cache lines
+    struct StatSlot {
+        std::atomic<uint64_t> enqueued{0}, executed{0}, stolen{0};
+        std::atomic<uint64_t> waiting{0}, running{0}; // nanoseconds
+        std::array<std::atomic<uint64_t>, 40> run_time;
+        std::vector<TraceEvent> events; // of a worker, only while tracing
+        char padding[64];
+        StatSlot() { for (auto &b : run_time) b = 0; }
+    };
+
+    uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    }
+    void count_enqueue(size_t depth);
+    void count_wait(size_t index, uint64_t start);
+
+    std::vector<std::unique_ptr<StatSlot>> slots; // one per worker and one for outside threads
+    std::atomic<size_t> max_depth{0};
+    std::atomic<bool> tracing{false};
+    const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+#endif
+};
+
+#if THREADPOOL_STATS
+inline void ThreadPool::count_enqueue(size_t depth)
+{
+    slots[current_worker()]->enqueued.fetch_add(1, std::memory_order_relaxed);
+    size_t seen = max_depth.load(std::memory_order_relaxed);
+    while (depth > seen && !max_depth.compare_exchange_weak(seen, depth, std::memory_order_relaxed)) { }
+}
+
+inline void ThreadPool::count_wait(size_t index, uint64_t start)
+{
+    uint64_t duration = now() - start;
+    StatSlot &s = *slots[index];
+    s.waiting.fetch_add(duration, std::memory_order_relaxed);
+    if (tracing.load(std::memory_order_relaxed))
+        s.events.push_back(TraceEvent{false, start, duration});
+}
+#endif
+
+// Runs a task taken by the thread with this index (size() for outside threads)
+inline void ThreadPool::run_task(Task &task, size_t index)
+{
+#if THREADPOOL_STATS
+    uint64_t start = now();
+    task();
+    uint64_t duration = now() - start;
+    StatSlot &s = *slots[index];
+    s.executed.fetch_add(1, std::memory_order_relaxed);
+    s.running.fetch_add(duration, std::memory_order_relaxed);
+    int bucket = 0;
+    while (bucket < int(s.run_time.size()) - 1 && duration >> (bucket + 1) != 0)
+        ++bucket;
+    s.run_time[bucket].fetch_add(1, std::memory_order_relaxed);
+    if (index < workers.size() && tracing.load(std::memory_order_relaxed))
+        s.events.push_back(TraceEvent{true, start, duration});
+#else
+    (void)index;
+    task();
+#endif
+}
+
+inline void Worker::operator()()
+{
+    ThreadPool::current_pool() = &pool;
+    ThreadPool::current_index() = index;
+    if (pool.mode == ThreadPool::Mode::WorkStealing)
+        run_stealing();
+    else
+        run_shared();
+}
+
+inline void Worker::run_shared()
+{
+    while (true)
+    {
+        {
+            Task task;
+            {
+                ThreadPool::WorkQueue &own = *pool.queues[index];
+                std::unique_lock<std::mutex> locker(pool.queue_mutex);
+#if THREADPOOL_STATS
+                bool parks = pool.tasks.empty() && own.pinned_count == 0 && !pool.stop;
+                uint64_t parked = parks ? pool.now() : 0;
+#endif
+                pool.cond.wait(locker, [&]() {
+                    return !pool.tasks.empty() || own.pinned_count > 0 || pool.stop;
+                });
+#if THREADPOOL_STATS
+                if (parks)
+                    pool.count_wait(index, parked);
+#endif
+                if (own.pinned_count > 0)
+                {
+                    locker.unlock();
+                    if (!pool.pop_pinned(index, task)) continue; // dropped by a cancel
+                }
+                else
+                {
+                    if (pool.tasks.empty()) return; // stopped and drained
+                    task = std::move(pool.tasks.front());
+                    pool.tasks.pop_front();
+                    if (pool.capacity > 0)
+                        pool.space.notify_one();
+                }
+            }
+            pool.run_task(task, index);
+        } // the task and its captures are released before it counts as finished
+        pool.finish_task();
+    }
+}
+
+inline void Worker::run_stealing()
+{
+    while (true)
+    {
+        {
+            Task task;
+            if (pool.pop_pinned(index, task) || pool.pop(index, task) || pool.steal(index, task))
+            {
+                pool.run_task(task, index);
+                task = nullptr;
+                pool.finish_task();
+                continue;
+            }
+        }
+
+        // Nothing to pop or steal: park until a producer publishes a task.
+        // idle is raised under queue_mutex before pending is checked, so a
+        // producer either sees us parked or we see its task.
+        ThreadPool::WorkQueue &own = *pool.queues[index];
+        std::unique_lock<std::mutex> locker(pool.queue_mutex);
+        if (pool.stop && pool.pending == 0 && own.pinned_count == 0) return; // stopped and drained
+        ++pool.idle;
+#if THREADPOOL_STATS
+        uint64_t parked = pool.now();
+#endif
+        pool.cond.wait(locker, [&]() { return pool.pending > 0 || own.pinned_count > 0 || pool.stop;});
+        --pool.idle;
+#if THREADPOOL_STATS
+        pool.count_wait(index, parked);
+#endif
+    }
+}
+
+inline ThreadPool::ThreadPool(size_t threads, Mode mode, size_t capacity)
+    : pending(0), idle(0), blocked(0), next_queue(0), unfinished(0),
+      capacity(capacity), stop(false), cancelled(false), mode(mode)
+{
+    for (size_t i = 0; i < threads; ++i)
+        queues.emplace_back(new WorkQueue);
+#if THREADPOOL_STATS
+    for (size_t i = 0; i <= threads; ++i)
+        slots.emplace_back(new StatSlot);
+#endif
+    for (size_t i = 0; i < threads; ++i)
+        workers.push_back(std::thread(Worker(*this, i)));
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    shutdown(Shutdown::Drain);
+}
+
+inline void ThreadPool::shutdown(Shutdown policy)
+{
+    std::deque<Task> dropped;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (policy == Shutdown::Cancel)
+        {
+            cancelled = true;
+            dropped.swap(tasks);
+        }
+        stop = true; // stop all threads
+        cond.notify_all();
+        space.notify_all();
+    }
+    if (policy == Shutdown::Cancel)
+    {
+        for (auto &q : queues) {
+            std::lock_guard<std::mutex> lock(q->mutex);
+            pending -= q->tasks.size();
+            for (auto &task : q->tasks)
+                dropped.push_back(std::move(task));
+            q->tasks.clear();
+            for (auto &task : q->pinned)
+                dropped.push_back(std::move(task));
+            q->pinned.clear();
+            q->pinned_count = 0;
+        }
+    }
+    // Destroy the dropped tasks outside the locks, their captures may enqueue
+    size_t n = dropped.size();
+    dropped.clear();
+    if (n > 0)
+        finish_task(n);
+
+    for (auto &thread: workers)
+        if (thread.joinable())
+            thread.join();
+}
+
+inline void ThreadPool::finish_task(size_t n)
+{
+    if ((unfinished -= n) == 0)
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_cond.notify_all();
+    }
+}
+
+inline void ThreadPool::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    idle_cond.wait(lock, [&]() { return unfinished == 0; });
+}
+
+inline bool ThreadPool::run_one()
+{
+    Task task;
+    size_t index = current_worker();
+    if (mode == Mode::SharedQueue)
+    {
+        if (index >= workers.size() || !pop_pinned(index, task))
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (tasks.empty()) return false;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            if (capacity > 0)
+                space.notify_one();
+        }
+    }
+    else if (index < workers.size())
+    {
+        if (!pop_pinned(index, task) && !pop(index, task) && !steal(index, task))
+            return false;
+    }
+    else
+    {
+        // An outside thread takes from every deque; steal() skips the one at its index
+        if (!steal(0, task) && !pop(0, task))
+            return false;
+    }
+    run_task(task, index);
+    task = nullptr;
+    finish_task();
+    return true;
+}
+
+inline const ThreadPool *&ThreadPool::current_pool()
+{
+    static thread_local const ThreadPool *pool = nullptr;
+    return pool;
+}
+
+inline size_t &ThreadPool::current_index()
+{
+    static thread_local size_t index = 0;
+    return index;
+}
+
+// Index of the calling worker in this pool, or size() for outside threads
+inline size_t ThreadPool::current_worker() const
+{
+    return current_pool() == this ? current_index() : workers.size();
+}
+
+/*
+ * Queue a task. Only outside producers are held to the capacity: a task
+ * spawned by a running task always gets in, otherwise a full queue could
+ * leave every worker blocked on itself. Likewise, while draining only
+ * running tasks may still add work.
+ */
+inline bool ThreadPool::push(Task task, bool block)
+{
+    size_t index = current_worker();
+    bool inside = index < workers.size();
+
+    if (mode == Mode::SharedQueue)
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (!inside && capacity > 0)
+        {
+            if (!block && tasks.size() >= capacity) return false;
+            space.wait(lock, [&]() { return tasks.size() < capacity || stop; });
+        }
+        if (cancelled || (stop && !inside)) return false;
+        ++unfinished;
+        tasks.push_back(std::move(task));
+#if THREADPOOL_STATS
+        count_enqueue(tasks.size());
+#endif
+        cond.notify_one();
+        return true;
+    }
+
+    if (inside)
+        ++pending;
+    else if (!reserve(block))
+        return false;
+    ++unfinished;
+    if (cancelled || (stop && !inside))
+    {
+        release();
+        finish_task();
+        return false;
+    }
+
+    // Workers push onto their own deque, outside threads spread round-robin
+    if (!inside)
+        index = next_queue++ % queues.size();
+    {
+        WorkQueue &q = *queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+#if THREADPOOL_STATS
+    count_enqueue(pending);
+#endif
+    if (idle > 0)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        cond.notify_one();
+    }
+    return true;
+}
+
+/*
+ * Queue a task for one worker. stop is checked under queue_mutex, where the
+ * workers decide to exit, so a worker never leaves a pinned task behind.
+ * Every worker is woken because only the one the task is for can take it.
+ */
+inline bool ThreadPool::push_to(size_t worker, Task task)
+{
+    if (worker >= queues.size())
+        throw std::out_of_range("no such worker in the ThreadPool");
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (stop) return false;
+    ++unfinished;
+    {
+        WorkQueue &q = *queues[worker];
+        std::lock_guard<std::mutex> qlock(q.mutex);
+        q.pinned.push_back(std::move(task));
+        ++q.pinned_count;
+    }
+#if THREADPOOL_STATS
+    slots[current_worker()]->enqueued.fetch_add(1, std::memory_order_relaxed);
+#endif
+    cond.notify_all();
+    return true;
+}
+
+// Take the oldest task queued for this worker
+inline bool ThreadPool::pop_pinned(size_t index, Task &task)
+{
+    WorkQueue &q = *queues[index];
+    if (q.pinned_count == 0) return false;
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.pinned.empty()) return false;
+    task = std::move(q.pinned.front());
+    q.pinned.pop_front();
+    --q.pinned_count;
+    return true;
+}
+
+inline bool ThreadPool::pin_workers()
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return false;
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus.push_back(cpu);
+    return pin_workers(cpus);
+#else
+    return false;
+#endif
+}
+
+inline bool ThreadPool::pin_workers(const std::vector<int> &cpus)
+{
+#ifdef __linux__
+    if (cpus.empty())
+        return false;
+
+    bool pinned = true;
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[i % cpus.size()], &set);
+        pinned = pthread_setaffinity_np(workers[i].native_handle(), sizeof(set), &set) == 0 && pinned;
+    }
+    return pinned;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// Claim a slot in pending, waiting for one to free up if the pool is full
+inline bool ThreadPool::reserve(bool block)
+{
+    size_t n = pending;
+    while (true)
+    {
+        if (capacity == 0 || n < capacity)
+        {
+            if (pending.compare_exchange_weak(n, n + 1)) return true;
+            continue;
+        }
+        if (!block) return false;
+
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        ++blocked;
+        space.wait(lock, [&]() { n = pending; return n < capacity || stop; });
+        --blocked;
+        if (stop) return false;
+    }
+}
+
+// A task left a deque; wake a producer waiting for room
+inline void ThreadPool::release()
+{
+    --pending;
+    if (capacity > 0 && blocked > 0)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        space.notify_one();
+    }
+}
+
+// Take the newest task from our own deque
+inline bool ThreadPool::pop(size_t index, Task &task)
+{
+    WorkQueue &q = *queues[index];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) return false;
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+    }
+    release();
+    return true;
+}
+
+// Take the oldest task from the first other deque that has one
+inline bool ThreadPool::steal(size_t index, Task &task)
+{
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+        WorkQueue &q = *queues[(index + i) % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        release();
+#if THREADPOOL_STATS
+        slots[current_worker()]->stolen.fetch_add(1, std::memory_order_relaxed);
+#endif
+        return true;
+    }
+    return false;
+}
+
+inline PoolStats ThreadPool::stats() const
+{
+    PoolStats result;
+    result.enabled = THREADPOOL_STATS != 0;
+    result.max_queue_depth = 0;
+    result.run_time.fill(0);
+#if THREADPOOL_STATS
+    for (const auto &slot : slots) {
+        const StatSlot &s = *slot;
+        PoolStats::Thread thread = { s.enqueued.load(), s.executed.load(), s.stolen.load(),
+                                     s.waiting.load() * 1e-9, s.running.load() * 1e-9 };
+        result.threads.push_back(thread);
+        for (size_t b = 0; b < s.run_time.size(); ++b)
+            result.run_time[b] += s.run_time[b].load();
+    }
+    result.max_queue_depth = max_depth.load();
+#endif
+    return result;
+}
+
+inline void ThreadPool::trace(bool on)
+{
+#if THREADPOOL_STATS
+    tracing = on;
+#else
+    (void)on;
+#endif
+}
+
+inline bool ThreadPool::write_trace(const std::string &path) const
+{
+#if THREADPOOL_STATS
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "{\"traceEvents\": [";
+    const char *separator = "\n";
+    for (size_t i = 0; i < workers.size(); ++i) {
+        out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << i
+            << ", \"args\": {\"name\": \"worker " << i << "\"}}";
+        separator = ",\n";
+        for (const TraceEvent &e : slots[i]->events)
+            out << ",\n{\"name\": \"" << (e.task ? "task" : "wait") << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+                << i << ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << e.duration / 1000.0 << "}";
+    }
+    out << "\n]}\n";
+    return bool(out);
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+template<class F>
+void ThreadPool::enqueue(F f)
+{
+    if (!push(Task(std::move(f)), true))
+        throw std::runtime_error("enqueue on a ThreadPool that was shut down");
+}
+
+template<class F>
+bool ThreadPool::try_enqueue(F f)
+{
+    return push(Task(std::move(f)), false);
+}
+
+template<class F>
+void ThreadPool::enqueue_to(size_t worker, F f)
+{
+    if (!push_to(worker, Task(std::move(f))))
+        throw std::runtime_error("enqueue on a ThreadPool that was shut down");
+}
+
+// Task body that owns a packaged_task; lambdas cannot move-capture in C++11
+template<class R>
+struct PackagedCall {
+    std::packaged_task<R()> task;
+    void operator()() { task(); }
+};
+
+// Run f(args...) on the pool; the future carries its result or exception
+template<class F, class... Args>
+auto ThreadPool::submit(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using R = typename std::result_of<F(Args...)>::type;
+    std::packaged_task<R()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<R> result = task.get_future();
+    enqueue(PackagedCall<R>{std::move(task)});
+    return result;
+}
+
+template<class F, class... Args>
+auto ThreadPool::submit_to(size_t worker, F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using R = typename std::result_of<F(Args...)>::type;
+    std::packaged_task<R()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<R> result = task.get_future();
+    enqueue_to(worker, PackagedCall<R>{std::move(task)});
+    return result;
+}
+
+/*
+ * A batch of tasks on a ThreadPool that can be waited on as a whole.
+ * Tasks passed to then() are held back until every task submitted to the
+ * group so far has finished, and are then enqueued on the pool.
+ * A task cancelled by ThreadPool::shutdown counts as finished.
+ */
+class TaskGroup {
+public:
+    TaskGroup(ThreadPool &pool): pool(pool), state(std::make_shared<State>()) { }
+    ~TaskGroup() { wait(); }
+    template<class F, class... Args>
+    auto submit(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    template<class F>
+    auto then(F f) -> std::future<typename std::result_of<F()>::type>;
+    void wait(); // not from a task of this group
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t pending = 0;
+        std::vector<Task> continuations;
+    };
+
+    // Finishes its task when the pool destroys it, whether it ran or not
+    struct Completion {
+        std::shared_ptr<State> state;
+        Completion(const std::shared_ptr<State> &s): state(s) { }
+        Completion(Completion &&other) = default;
+        ~Completion() { if (state) finish(state); }
+    };
+
+    template<class R>
+    struct Call {
+        std::packaged_task<R()> task;
+        Completion done;
+        void operator()() { task(); }
+    };
+
+    // Queues a held-back then() task once the group is done
+    template<class R>
+    struct Continuation {
+        ThreadPool *pool;
+        std::packaged_task<R()> task;
+        // push instead of enqueue: never throws, a continuation dropped by shutdown breaks its promise
+        void operator()() { pool->push(PackagedCall<R>{std::move(task)}, true); }
+    };
+
+    static void finish(const std::shared_ptr<State> &state);
+
+    ThreadPool &pool;
+    std::shared_ptr<State> state;
+};
+
+inline void TaskGroup::finish(const std::shared_ptr<State> &state)
+{
+    std::vector<Task> ready;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (--state->pending > 0) return;
+        ready.swap(state->continuations);
+        state->done.notify_all();
+    }
+    for (auto &c : ready)
+        c();
+}
+
+inline void TaskGroup::wait()
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&]() { return state->pending == 0; });
+}
+
+template<class F, class... Args>
+auto TaskGroup::submit(F &&f, Args &&... args) -> std::future<typename std::result_of<F(Args...)>::type>
+{
+    using R = typename std::result_of<F(Args...)>::type;
+    std::packaged_task<R()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<R> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        ++state->pending;
+    }
+    pool.enqueue(Call<R>{std::move(task), Completion(state)});
+    return result;
+}
+
+template<class F>
+auto TaskGroup::then(F f) -> std::future<typename std::result_of<F()>::type>
+{
+    using R = typename std::result_of<F()>::type;
+    std::packaged_task<R()> task(std::move(f));
+    std::future<R> result = task.get_future();
+    Task run(Continuation<R>{&pool, std::move(task)});
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->pending > 0)
+        {
+            state->continuations.push_back(std::move(run));
+            return result;
+        }
+    }
+    run();
+    return result;
+}
+
+#endif // THREADPOOL_H
@@ -0,0 +1,20 @@
+// timing.cpp
+
+#include <algorithm>
+#include "timing.h"
+
+double Stopwatch::lap()
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - start).count();
+    start = now;
+    return elapsed;
+}
+
+double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) return 0;
+    const size_t k = std::min(samples.size() - 1, size_t(std::max(0.0, p) * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
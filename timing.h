@@ -0,0 +1,45 @@
+// timing.h
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Wall clock time since it was started, clock() would add up the CPU time of all threads
+class Stopwatch {
+public:
+    Stopwatch(): start(std::chrono::steady_clock::now()) { }
+    void restart() { start = std::chrono::steady_clock::now(); }
+    double seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+    // The seconds so far, and starts again
+    double lap();
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// The value below which a fraction p of samples lie, the nearest one, 0 without any
+double percentile(std::vector<double> samples, double p);
+inline double median(const std::vector<double> &samples) { return percentile(samples, 0.5); }
+
+/*
+ Seconds of every one of repetitions runs of f, sorted, after warmup runs that are not timed.
+ f returns whatever it likes, the value of the last timed run is kept in last.
+ */
+template<class F, class R>
+std::vector<double> timeRuns(F f, int warmup, int repetitions, R &last)
+{
+    for (int i = 0; i < warmup; i++)
+        f();
+    std::vector<double> seconds;
+    for (int i = 0; i < repetitions; i++) {
+        Stopwatch watch;
+        last = f();
+        seconds.push_back(watch.seconds());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    return seconds;
+}
+
+#endif // TIMING_H
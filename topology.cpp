@@ -0,0 +1,155 @@
+// topology.cpp
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include "topology.h"
+#include "threadpool.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+int Topology::read_int(const std::string &path, int fallback)
+{
+    std::ifstream in(path);
+    int value;
+    return in >> value ? value : fallback;
+}
+
+// The node of every CPU listed in /sys/devices/system/node, from lists like 0-3,8-11
+std::map<int, int> Topology::read_nodes()
+{
+    std::map<int, int> node_of;
+    for (int node = 0; node < 256; ++node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            int first = 0, last = -1;
+            char dash;
+            std::istringstream parse(range);
+            if (!(parse >> first)) continue;
+            if (!(parse >> dash >> last)) last = first;
+            for (int cpu = first; cpu <= last; ++cpu)
+                node_of[cpu] = node;
+        }
+    }
+    return node_of;
+}
+
+Topology::Topology(): nr_cores(0), nr_nodes(0)
+{
+    std::vector<int> ids;
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed))
+                ids.push_back(cpu);
+#endif
+    if (ids.empty())
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            ids.push_back(cpu);
+
+    // Cores are numbered within their package, the pair of both is unique
+    std::map<std::pair<int, int>, int> cores;
+    std::map<int, int> siblings; // hardware threads seen per core so far
+    std::map<int, bool> nodes;
+    const std::map<int, int> node_of = read_nodes();
+    for (int id : ids) {
+        const std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(id);
+        int package = read_int(dir + "/topology/physical_package_id", 0);
+        int core_id = read_int(dir + "/topology/core_id", id);
+        auto known = node_of.find(id);
+        int node = known != node_of.end() ? known->second : 0;
+        auto key = std::make_pair(package, core_id);
+        if (cores.find(key) == cores.end()) {
+            int next = int(cores.size());
+            cores[key] = next;
+        }
+        int core = cores[key];
+        Cpu cpu = { id, core, node, siblings[core]++ };
+        all.push_back(cpu);
+        nodes[node] = true;
+    }
+    nr_cores = cores.size();
+    nr_nodes = nodes.size();
+}
+
+const Topology &Topology::detect()
+{
+    static const Topology topology;
+    return topology;
+}
+
+std::vector<int> placement(const Topology &topology, Pinning pinning, size_t threads)
+{
+    std::vector<Cpu> order = topology.cpus();
+    if (pinning == Pinning::Cores)
+        order.erase(std::remove_if(order.begin(), order.end(), [](const Cpu &c) { return c.sibling > 0; }),
+                    order.end());
+
+    if (pinning == Pinning::Scatter) {
+        // Rank of the core within its node, so the nodes take turns
+        std::map<int, int> seen;
+        std::map<int, int> rank;
+        std::vector<Cpu> sorted = order;
+        std::sort(sorted.begin(), sorted.end(), [](const Cpu &a, const Cpu &b) { return a.core < b.core; });
+        for (const Cpu &c : sorted)
+            if (rank.find(c.core) == rank.end())
+                rank[c.core] = seen[c.node]++;
+        std::stable_sort(order.begin(), order.end(), [&](const Cpu &a, const Cpu &b) {
+            return std::make_tuple(a.sibling, rank[a.core], a.node) < std::make_tuple(b.sibling, rank[b.core], b.node);
+        });
+    }
+    else {
+        std::stable_sort(order.begin(), order.end(), [](const Cpu &a, const Cpu &b) {
+            return std::make_tuple(a.node, a.core, a.sibling) < std::make_tuple(b.node, b.core, b.sibling);
+        });
+    }
+
+    std::vector<int> cpus;
+    for (size_t i = 0; i < threads && !order.empty(); ++i)
+        cpus.push_back(order[i % order.size()].id);
+    return cpus;
+}
+
+bool parsePinning(const std::string &name, Pinning &pinning)
+{
+    if (name == "none") pinning = Pinning::None;
+    else if (name == "compact") pinning = Pinning::Compact;
+    else if (name == "scatter") pinning = Pinning::Scatter;
+    else if (name == "cores") pinning = Pinning::Cores;
+    else return false;
+    return true;
+}
+
+const PoolConfig &poolConfig()
+{
+    static const PoolConfig config = []() {
+        const Topology &topology = Topology::detect();
+        PoolConfig c = { 0, Pinning::None };
+        const char *pinning = std::getenv("CONCURRENT_PINNING");
+        if (pinning != nullptr && !parsePinning(pinning, c.pinning))
+            std::cerr << "ignoring unknown CONCURRENT_PINNING " << pinning << std::endl;
+        const char *threads = std::getenv("CONCURRENT_THREADS");
+        if (threads != nullptr)
+            c.threads = std::max(0, std::atoi(threads));
+        if (c.threads == 0)
+            c.threads = c.pinning == Pinning::Cores ? topology.cores() : topology.cpus().size();
+        c.threads = std::max<size_t>(1, c.threads);
+        return c;
+    }();
+    return config;
+}
+
+bool applyPinning(ThreadPool &pool, Pinning pinning)
+{
+    if (pinning == Pinning::None)
+        return true;
+    return pool.pin_workers(placement(Topology::detect(), pinning, pool.size()));
+}
@@ -0,0 +1,70 @@
+// topology.h
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// One logical CPU this process may run on
+struct Cpu {
+    int id;      // as the operating system numbers it
+    int core;    // physical core, unique over all packages
+    int node;    // NUMA node
+    int sibling; // 0 for the first hardware thread of its core, 1 for the second, ...
+};
+
+/*
+ The CPUs this process may run on, with their cores and NUMA nodes. On Linux it is read from
+ /sys; elsewhere, or when /sys tells nothing, every CPU counts as a core of its own on node 0.
+ */
+class Topology {
+public:
+    static const Topology &detect(); // once, on the first call
+    const std::vector<Cpu> &cpus() const { return all; }
+    size_t cores() const { return nr_cores; }
+    size_t nodes() const { return nr_nodes; }
+private:
+    Topology();
+    static int read_int(const std::string &path, int fallback);
+    static std::map<int, int> read_nodes();
+
+    std::vector<Cpu> all;
+    size_t nr_cores, nr_nodes;
+};
+
+/*
+ Where the workers of a pool go:
+ None     not pinned, the scheduler decides
+ Compact  worker after worker on the hardware threads of one core, then the next core of the
+          same node, then the next node: the workers share caches
+ Scatter  one worker per node in turn and one per core before any core gets a second: the
+          workers get the most cache and memory bandwidth each
+ Cores    like Compact on the first hardware thread of every core only, never two on a core
+ */
+enum class Pinning { None, Compact, Scatter, Cores };
+
+// The CPUs for the first threads workers under a policy, repeating them if there are too few
+std::vector<int> placement(const Topology &topology, Pinning pinning, size_t threads);
+
+/*
+ Worker count and pinning for the pools of every program. The defaults come from the topology:
+ one worker per CPU this process may use, or one per core with Pinning::Cores. The environment
+ overrides them, CONCURRENT_THREADS with a worker count and CONCURRENT_PINNING with none,
+ compact, scatter or cores.
+ */
+struct PoolConfig {
+    size_t threads;
+    Pinning pinning;
+};
+
+const PoolConfig &poolConfig(); // read once, on the first call
+bool parsePinning(const std::string &name, Pinning &pinning);
+// Pins the workers of pool by policy, true if nothing had to be pinned or all pins took
+bool applyPinning(ThreadPool &pool, Pinning pinning);
+
+#endif // TOPOLOGY_H
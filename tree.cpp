@@ -1,148 +1,105 @@
 // tree.cpp
-// compile with: g++ -std=c++11 tree.cpp -o tree
+// compile with: g++ -std=c++11 -pthread tree.cpp nodes.cpp topology.cpp timing.cpp -o tree
 
 #include <iostream>
-#include <future>
 #include <thread>
-#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include "tree.h"
+#include "topology.h"
+#include "timing.h"
 
 using namespace std;
 
-int valtab[127]; // used for integer values of variables
-
-class Tree; // forward declare
-
-class Node {
-protected:
-    Node() { use = 1; }
-    virtual void print(ostream &os) = 0;
-    virtual ~Node() { }
-    virtual int eval() = 0;
-private:
-   friend class Tree;
-   friend ostream& operator<<(ostream&, const Tree&);
-   int use; // reference count
-};
-
-class Tree {
-public:
-    Tree(int n); // constant
-    Tree(char id); // variable
-    Tree(char op, Tree t); // unary operator
-    Tree(char op, Tree left, Tree right); // binary operator
-    Tree(const Tree &t) { p = t.p; ++p->use; }
-    ~Tree() { if (--p->use == 0) delete p; }
-    void operator=(const Tree &t);
-    int eval() { return p->eval(); }
-private:
-    friend class Node;
-    friend ostream& operator<<(ostream &os, const Tree &t);
-    Node *p; // polymorphic hierarchy
-};
-
-void Tree::operator=(const Tree &t)
-{
-    ++t.p->use;
-    if (--p->use == 0) 
-        delete p;
-    p = t.p;
-}
-
-ostream& operator<<(ostream &os, const Tree &t)
-{
-    t.p->print(os);
-    return os;
-}
-
-class LeafNode: public Node {
-private:
-    friend class Tree;
-    void print(ostream &os) = 0;
-    virtual int eval() = 0;
-};
-
-class IntNode: public LeafNode {
-public:
-    int eval() { return n; }
-private:
-    friend class Tree;
-    int n;
-    void print(ostream &os) { os << n ;}
-    IntNode(int k): n(k) { }
-};
-
-class IdNode: public LeafNode {
-public:
-    int eval() { return valtab[name]; }
-private:
-    friend class Tree;
-    char name;
-    void print(ostream& o) { o << name; }
-    IdNode(char id): name(id) { }
-};
-
-class UnaryNode: public Node {
-public:
-    int eval();
-private:
-    friend class Tree;
-    const char op;
-    Tree opnd;
-    UnaryNode(char a, Tree b): op(a), opnd(b) { }
-    void print(ostream& o) { o << "(" << op << opnd << ")"; }
-};
-
-int UnaryNode::eval()
-{
-    switch (op) {
-        case '-': return (-opnd.eval());
-        case '+': return (+opnd.eval());
-        default: cerr << "no operand" << endl;
-            return 0;
-    }
-}
-
-class BinaryNode: public Node {
-public:
-    int eval();
-private:
-    friend class Tree;
-    const char op;
-    Tree left;
-    Tree right;
-    BinaryNode(char a, Tree b, Tree c): op(a), left(b), right(c) { }
-    void print(ostream &os) { os << "(" << left << op << right << ")"; }
-};
-
-int BinaryNode::eval()
-{
-    std::future<int> task = std::async(&Tree::eval, left);
-    int rightvalue = right.eval();
-    int leftvalue = task.get();
-
-    switch (op) {
-        case '-': return (leftvalue - rightvalue);
-        case '+': return (leftvalue + rightvalue);
-        case '*': return (leftvalue * rightvalue);
-        default: cerr << "no operand" << endl;
-            return 0;
-    }
-
-}
-
-Tree::Tree(int n) { p = new IntNode(n); }
-Tree::Tree(char id) { p = new IdNode(id); }
-Tree::Tree(char op, Tree t) { p = new UnaryNode(op, t); }
-Tree::Tree(char op, Tree left, Tree right) { p = new BinaryNode(op, left, right); }
-
-int main()
+// usage: tree [depth of the big tree] [threshold] [bindings]
+int main(int argc, char *argv[])
 {   
+    const int depth = argc > 1 ? atoi(argv[1]) : 18;
+    const size_t threshold = argc > 2 ? atoi(argv[2]) : 10000;
+    const size_t nr_bindings = argc > 3 ? atoi(argv[3]) : 10000;
+    ThreadPool pool(poolConfig().threads, ThreadPool::Mode::WorkStealing);
+    applyPinning(pool, poolConfig().pinning);
+
     valtab['A'] = 3; valtab['B'] = 4;
     cout << "A = 3, B = 4" << endl;
     Tree t1 = Tree('*', Tree('-', 5), Tree('+', 'A', 4));
     Tree t2 = Tree('+', Tree('-', 'A', 1), Tree('+', t1, 'B'));
     cout << "t1 = " << t1 << ", t2 = " << t2 << endl;
     cout << "t1 = " << t1.eval() << ", t2 = " << t2.eval() << endl;
+    cout << "t1 = " << t1.eval(pool) << ", t2 = " << t2.eval(pool) << " (on the pool)" << endl;
+    cout << "t1 = " << t1.compile().eval(valtab) << ", t2 = " << t2.compile().eval(valtab) << " (compiled)" << endl;
+
+    Tree big = balanced(depth);
+    Stopwatch watch;
+    int sequential = big.eval();
+    double first = watch.lap();
+    int parallel = big.eval(pool, threshold);
+    double second = watch.lap();
+    cout << big.size() << " nodes: " << sequential << " in " << first << " seconds, "
+         << parallel << " in " << second << " seconds on " << pool.size()
+         << " workers" << endl;
+
+    // Building and dropping the tree on the heap and in an arena
+    watch.restart();
+    {
+        Tree heap = balanced(depth);
+    }
+    first = watch.lap();
+    {
+        NodeArena arena(false);
+        Tree plain = balanced(arena, depth);
+    }
+    second = watch.lap();
+    cout << "built and dropped on the heap in " << first << " seconds, in an arena in " << second
+         << " seconds" << endl;
+
+    // With hash consing the repeated subtrees are made once and evaluated once
+    {
+        NodeArena arena;
+        Tree shared = balanced(arena, depth);
+        Memo memo;
+        watch.restart();
+        int memoized = shared.eval(memo);
+        first = watch.lap();
+        cout << "hash consed into " << arena.nodes() << " nodes: " << memoized << " in "
+             << first << " seconds memoized" << endl;
+
+        Tree s1 = arena.binary('*', arena.unary('-', arena.constant(5)), arena.binary('+', arena.variable('A'), arena.constant(4)));
+        size_t before = arena.nodes();
+        Tree s2 = arena.binary('+', arena.binary('-', arena.variable('A'), arena.constant(1)),
+                               arena.binary('+', arena.binary('*', arena.unary('-', arena.constant(5)),
+                                                              arena.binary('+', arena.variable('A'), arena.constant(4))),
+                                            arena.variable('B')));
+        Memo fresh;
+        cout << "t2 = " << s2 << " = " << s2.eval(fresh) << ", sharing t1 it needs only "
+             << arena.nodes() - before << " new nodes" << endl;
+    }
+
+    // The compiled form of a smaller tree, over many values of A and B
+    Tree medium = Tree('*', balanced(10), Tree('-', 'A', 'B'));
+    Program program = medium.compile();
+    vector<int> bindings(2 * nr_bindings), results(nr_bindings);
+    for (size_t k = 0; k < nr_bindings; ++k) {
+        bindings[k] = k;                     // A
+        bindings[nr_bindings + k] = 2 * k;   // B
+    }
+    bool b_first = program.variables()[0] == 'B';
+    watch.restart();
+    int mismatches = 0;
+    for (size_t k = 0; k < nr_bindings; ++k) {
+        valtab['A'] = bindings[b_first ? nr_bindings + k : k];
+        valtab['B'] = bindings[b_first ? k : nr_bindings + k];
+        results[k] = medium.eval();
+    }
+    first = watch.lap();
+    vector<int> compiled(nr_bindings);
+    program.eval_batch(bindings.data(), nr_bindings, compiled.data());
+    second = watch.lap();
+    for (size_t k = 0; k < nr_bindings; ++k)
+        mismatches += results[k] != compiled[k];
+    cout << nr_bindings << " bindings of " << medium.size() << " nodes: tree " << first << " seconds, "
+         << program.size() << " instructions " << second << " seconds, "
+         << mismatches << " different results" << endl;
 
     return 0;
 }
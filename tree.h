@@ -0,0 +1,185 @@
+// tree.h
+// Expression trees with shared, reference counted nodes
+
+#ifndef TREE_H
+#define TREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "threadpool.h"
+#include "cpu_features.h"
+
+extern int valtab[127]; // used for integer values of variables
+
+class Tree; // forward declare
+class Node;
+
+// Values of the subtrees evaluated so far, for one set of variable values
+typedef std::unordered_map<const Node *, int> Memo;
+
+enum class Opcode : unsigned char { Push, Load, Negate, Add, Subtract, Multiply, Zero };
+
+struct Instruction {
+    Opcode op;
+    int operand; // the constant of Push, the variable slot of Load
+};
+
+/*
+ A Tree compiled to postfix code for a stack machine, so evaluating it is one loop over a
+ contiguous array instead of virtual calls all over the heap. Variables are numbered in the
+ order they first appear, variables()[slot] is the name of a slot. Arithmetic wraps around.
+ */
+class Program {
+public:
+    // Evaluates with the variable values in table, indexed by name like valtab
+    int eval(const int *table) const;
+    /*
+     Evaluates count bindings at once: bindings[slot * count + k] is the value of variable slot
+     in binding k and results[k] gets its value. Runs 8 bindings per step with AVX2.
+     */
+    void eval_batch(const int *bindings, size_t count, int *results) const;
+    const std::vector<char> &variables() const { return vars; }
+    size_t size() const { return code.size(); }
+
+    // used by Node::compile
+    void emit(Opcode op, int operand = 0);
+    int slot(char name);
+private:
+    // The values of 8 bindings in one stack slot
+    struct Lanes {
+        unsigned v[8];
+    };
+
+    void eval_block(const int *bindings, size_t count, size_t first, int *results) const;
+#if HAVE_X86_SIMD
+    void eval_block_avx2(const int *bindings, size_t count, size_t first, int *results) const;
+#endif
+
+    static const int lanes = 8;
+    std::vector<Instruction> code;
+    std::vector<char> vars;
+    int depth = 0, max_depth = 0;
+};
+
+// a + b, but never more than the largest size_t
+size_t add_sizes(size_t a, size_t b);
+
+class Node {
+protected:
+    Node(size_t n = 1): size(n), use(1), in_arena(false) { }
+    virtual void print(std::ostream &os) = 0;
+    virtual ~Node() { }
+    virtual int eval() = 0;
+    // Evaluates subtrees of at least threshold nodes in parallel on pool
+    virtual int eval(ThreadPool &, size_t) { return eval(); }
+    // Evaluates every distinct node once, looking shared subtrees up in memo
+    virtual int eval(Memo &) { return eval(); }
+    // Appends the postfix code of the subtree
+    virtual void compile(Program &program) = 0;
+    // The operands of an operator, and its value given theirs; a leaf has none and is its value
+    virtual int arity() const { return 0; }
+    virtual const Tree *operand(int) const { return nullptr; }
+    virtual int combine(int, int) { return eval(); }
+    const size_t size; // nodes in the subtree, a shared subtree counts every time it is used
+private:
+   friend class Tree;
+   friend class NodeArena;
+   friend std::ostream& operator<<(std::ostream&, const Tree&);
+   std::atomic<int> use; // reference count, trees are shared between threads
+   bool in_arena; // owned by a NodeArena, which frees it; use is not kept
+};
+
+class Tree {
+public:
+    Tree(int n); // constant
+    Tree(char id); // variable
+    Tree(char op, Tree t); // unary operator
+    Tree(char op, Tree left, Tree right); // binary operator
+    Tree(const Tree &t) { p = t.p; acquire(p); }
+    ~Tree() { release(p); }
+    void operator=(const Tree &t);
+    int eval() { return p->eval(); }
+    int eval(ThreadPool &pool, size_t threshold = 10000) { return p->eval(pool, threshold); }
+    int eval(Memo &memo) { return p->eval(memo); }
+    size_t size() const { return p->size; }
+    /*
+     The parts of the root, to evaluate a tree some other way: the values of its arity()
+     operands (0, 1 or 2) go into combine, which gives the value of the root.
+     */
+    int arity() const { return p->arity(); }
+    const Tree &operand(int i) const { return *p->operand(i); }
+    int combine(int left, int right = 0) const { return p->combine(left, right); }
+    Program compile() const { Program program; compile(program); return program; }
+    void compile(Program &program) const { p->compile(program); }
+private:
+    friend class Node;
+    friend class NodeArena;
+    friend std::ostream& operator<<(std::ostream &os, const Tree &t);
+    explicit Tree(Node *node): p(node) { } // a node of a NodeArena
+    static void acquire(Node *node) { if (!node->in_arena) ++node->use; }
+    static void release(Node *node) { if (!node->in_arena && --node->use == 0) delete node; }
+    Node *p; // polymorphic hierarchy
+};
+
+std::ostream& operator<<(std::ostream &os, const Tree &t);
+
+/*
+ Makes trees whose nodes live in large chunks owned by the arena instead of one heap block
+ each. Arena nodes keep no reference count: copying or dropping such a Tree costs nothing and
+ every node is destroyed with the arena, so its trees must not be used after it is gone.
+ With std::hash consing a node is only made once for every distinct (operator, operands), which
+ turns repeated subtrees into shared ones that eval(Memo &) evaluates once.
+ */
+class NodeArena {
+public:
+    explicit NodeArena(bool hash_consing = true): hash_consing(hash_consing), used(chunk_size) { }
+    ~NodeArena();
+    Tree constant(int n);
+    Tree variable(char id);
+    Tree unary(char op, Tree t);
+    Tree binary(char op, Tree left, Tree right);
+    size_t nodes() const { return all.size(); }
+private:
+    NodeArena(const NodeArena &) = delete;
+    void operator=(const NodeArena &) = delete;
+
+    // What makes two nodes the same: operands are compared by node
+    struct Key {
+        char kind, op;
+        int value;
+        const Node *left, *right;
+        bool operator==(const Key &k) const
+        {
+            return kind == k.kind && op == k.op && value == k.value && left == k.left && right == k.right;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const
+        {
+            size_t h = std::hash<int>()(k.value) ^ (size_t(k.kind) << 8 | size_t((unsigned char)k.op));
+            h = h * 31 + std::hash<const Node *>()(k.left);
+            return h * 31 + std::hash<const Node *>()(k.right);
+        }
+    };
+
+    template <class N, class... Args> Tree make(const Key &key, Args &&... args);
+    void *allocate(size_t bytes);
+
+    static const size_t chunk_size = 64 * 1024;
+    const bool hash_consing;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used; // bytes of the last chunk handed out
+    std::vector<Node *> all; // in the order they were made
+    std::unordered_map<Key, Node *, KeyHash> table;
+};
+
+// The sum (B - A) + 1 + (B - A) + 1 + ... over 2^depth leaves, as a balanced tree
+Tree balanced(int depth);
+// The same tree made in an arena, with hash consing its halves are one shared subtree
+Tree balanced(NodeArena &arena, int depth);
+
+#endif // TREE_H
@@ -27,61 +27,65 @@ std::ostream &operator<<(std::ostream &os, const State &state)
     return os;
 }
 
-Player getCurrentPlayer(const State &state)
+Board toBoard(const State &state)
 {
-    int countX = 0;
-    int countO = 0;
+    Mask x = 0, o = 0;
     for (int i=0; i<9; i++) {
-        if (state[i] == Player::X) countX++;
-        else if(state[i] == Player::O) countO++;
+        x |= Mask(state[i] == Player::X) << i;
+        o |= Mask(state[i] == Player::O) << i;
     }
-    return (countX > countO ? Player::O : Player::X); 
+    Board board = { x, o, sideToMove(x, o) };
+    return board;
 }
 
-State doMove(const State &state, const Move &m)
+State toState(const Board &board)
 {
-    State result = state;
-    int countX = 0;
-    int countO = 0;
+    State state;
     for (int i=0; i<9; i++) {
-        if (result[i] == Player::X)
-        {
-            countX++;
-        }
-        else if(result[i] == Player::O)
-        {
-            countO++;
-        }
+        state[i] = board.x >> i & 1 ? Player::X : board.o >> i & 1 ? Player::O : Player::None;
     }
-    result[m] = (countX > countO ? Player::O : Player::X);
-    return result;
+    return state;
+}
+
+Player getCurrentPlayer(const State &state)
+{
+    return toBoard(state).toMove;
+}
+
+State doMove(const State &state, const Move &m)
+{
+    return toState(doMove(toBoard(state), m));
 }
 
 Player getWinner(const State &state)
 {
-    for (int r=0; r<3; r++)
-        if (state[r*3] == state[r*3+1] && state[r*3+1] == state[r*3+2] && state[r*3] != Player::None) 
-            return state[r*3];
-    for (int c=0; c<3; c++)
-        if (state[0+c] == state[3+c] && state[3+c] == state[6+c] && state[0+c] != Player::None) 
-            return state[0+c];
-    if (state[0] == state[4] && state[4] == state[8] && state[0] != Player::None) 
-        return state[0];
-    if (state[2] == state[4] && state[4] == state[6] && state[2] != Player::None) 
-        return state[2];
-    return Player::None;
+    return getWinner(toBoard(state));
 }
 
 std::vector<Move> getMoves(const State &state)
 {
     std::vector<Move> moves;
-    if (getWinner(state) == Player::None) {
-        for (int i=0; i<9; i++) {
-            if (state[i] == Player::None) {
-                moves.push_back(i);
-            }
-        }
+    for (Mask free = getMoveMask(toBoard(state)); free; free &= free - 1) {
+        moves.push_back(lowestSquare(free));
     }
     return moves;
 }
 
+Board playout(Board board, Xoshiro128 &rng)
+{
+    // The empty squares, a chosen one is swapped out with the last
+    Move moves[9];
+    int count = 0;
+    for (Mask free = getMoveMask(board); free; free &= free - 1) {
+        moves[count++] = lowestSquare(free);
+    }
+    while (count > 0) {
+        int k = rng.below(count);
+        Player mover = board.toMove;
+        board = doMove(board, moves[k]);
+        moves[k] = moves[--count];
+        // Only the player who just moved can have made a line
+        if (hasLine(mover == Player::X ? board.x : board.o)) break;
+    }
+    return board;
+}
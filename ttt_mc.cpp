@@ -2,120 +2,352 @@
 // Rendall Schijven
 
 #include <iostream>
+#include <string>
+#include <climits>
+#include <cstdlib>
 #include <algorithm>
 #include <vector>
 #include <map>
 #include <future>
 #include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
 #include "ttt_mc.h"
+#include "threadpool.h"
+#include "topology.h"
+#include "timing.h"
+#include "ttt_uct.h"
+#include "ttt_solver.h"
+#include "mnk.h"
 
 unsigned const n_trials = 15000;
 unsigned const mc_match = 1;
 unsigned const mc_other = 1;
-unsigned const n_threads = 4;
+unsigned const max_mc_tasks = 64;
+//One task per worker, as many workers as poolConfig gives, CONCURRENT_THREADS and CONCURRENT_PINNING
+unsigned const n_threads = unsigned(std::min<size_t>(poolConfig().threads, max_mc_tasks));
 
 enum class PlayerType { Human, Computer };
+enum class Engine { MonteCarlo, MonteCarloAtomic, Uct, Solver, Random };
 
 State mcTrial(const State &board)
 {
-    State testBoard = board;
-    std::vector<Move> moves = getMoves(board);
-
-    while(moves.size() > 0)
-    {
-        Move m = moves[rand() % moves.size()];
-        testBoard = doMove(testBoard, m);
-        moves = getMoves(testBoard);
-    }
-    return testBoard;
+    return toState(playout(toBoard(board), threadRng()));
 }
 
-void mcUpdateScores(std::array<int,9> &scores, const State &board, const Player &player)
-{
-    //Initialise mutex
-    std::mutex mutex;
+//How the workers add up their scores
+enum class Accumulation {
+    PerWorker, //every worker into its own array, added up once they are done
+    Atomic     //all workers into one array of atomic counters
+};
+
+using Scores = std::array<int,9>;
+using AtomicScores = std::array<std::atomic<int>,9>;
+
+//Each on its own cache line, so workers do not steal the line from each other
+struct alignas(64) WorkerScores {
+    Scores scores;
+};
+
+inline void addScore(int &score, int delta) { score += delta; }
+inline void addScore(std::atomic<int> &score, int delta) { score.fetch_add(delta, std::memory_order_relaxed); }
 
+template<typename ScoreArray>
+void mcUpdateScores(ScoreArray &scores, const State &board, const Player &player)
+{
     Player winner = getWinner(board);
+    Player other = player == Player::X ? Player::O : Player::X;
+
+    //A draw scores nothing, else the side that draws most random games would see every square as a loss
+    if(winner == Player::None) return;
 
     for(int i = 0; i < 9; i++)
     {
-        //If human won
-        if(winner != player)
+        //If the other side won
+        if(winner == other)
         {
-            //Lock the thread so only one thread can run the code at a time
-            mutex.lock();
-            if(board[i] == Player::X) scores[i] += mc_other;
-            if(board[i] == Player::O) scores[i] -= mc_match;
-            mutex.unlock();
+            if(board[i] == other) addScore(scores[i], mc_other);
+            if(board[i] == player) addScore(scores[i], -int(mc_match));
         }
 
         //If code won
         if(winner == player)
         {
-            mutex.lock();
-            if(board[i] == Player::O) scores[i] += mc_match;
-            if(board[i] == Player::X) scores[i] -= mc_other;
-            mutex.unlock();
+            if(board[i] == player) addScore(scores[i], mc_match);
+            if(board[i] == other) addScore(scores[i], -int(mc_other));
         }
     }
 }
 
 Move getBestMove(const std::array<int, 9> &scores, const State &board)
 {
-    int highScore = 0;
+    int highScore = INT_MIN;
 
+    //All free squares with the highest score, a higher one starts the list again
     std::vector<int> highestPositions;
     for(int i = 0; i < 9; i++)
     {
-        if(scores[i] >= highScore && board[i] == Player::None)
+        if(board[i] != Player::None || scores[i] < highScore) continue;
+        if(scores[i] > highScore)
         {
             highScore = scores[i];
-            highestPositions.push_back(i);
+            highestPositions.clear();
         }
+        highestPositions.push_back(i);
+    }
+    //select_randomly needs at least one square to pick from, fall back to the first free one
+    if(highestPositions.empty())
+    {
+        for(int i = 0; i < 9; i++)
+            if(board[i] == Player::None) return i;
+        return -1;
     }
-    Move m = highestPositions[rand() % highestPositions.size()];
+    Move m = *select_randomly(highestPositions.begin(), highestPositions.end());
     return m;
 }
 
-void parrallel_mcTrial(std::array<int,9> &scores, const State &board, const Player &player)
+template<typename ScoreArray>
+void parrallel_mcTrial(ScoreArray &scores, const State &board, const Player &player, uint64_t seed)
 {
     /*
      * Run mcTrial for the amount of trials divided by amount of
      * threads so each thread does the same amount of trials.
-     * Also updates the scores using mcUpdateScores where the mutex is used.
+     * Also updates the scores using mcUpdateScores, into scores of this task alone
+     * or into shared atomic ones.
+     * Every trial draws from the generator of this worker, seeded for this task.
      */
-    for(int i = 0; i < n_trials/ n_threads; i++)
+    Xoshiro128 &rng = threadRng();
+    rng.reseed(seed);
+    Board start = toBoard(board);
+    for(unsigned i = 0; i < n_trials/ n_threads; i++)
     {
-        State tempBoard = mcTrial(board);
+        State tempBoard = toState(playout(start, rng));
         mcUpdateScores(scores, tempBoard, player);
     }
 }
 
-Move mcMove(const State &board, const Player &player)
+//The pool is created on the first computer move and reused for every move after it
+ThreadPool &mcPool()
 {
-    std::array<int, 9> scores = {0,0,0,0,0,0,0,0,0};
+    static ThreadPool pool(n_threads, ThreadPool::Mode::WorkStealing);
+    static bool pinned = applyPinning(pool, poolConfig().pinning);
+    (void)pinned;
+    return pool;
+}
 
-    //Initialise an array of threads
-    std::vector<std::thread> workers;
+Move mcMove(const State &board, const Player &player, Accumulation accumulation = Accumulation::PerWorker)
+{
+    std::array<int, 9> scores = {0,0,0,0,0,0,0,0,0};
+    std::array<WorkerScores, max_mc_tasks> workerScores = {};
+    AtomicScores atomicScores = {};
 
-    //Create a thread with the parrallel_mcTrial function n_threads amount of times
-    for (int i = 0; i < n_threads; ++i) {
-        workers.push_back(std::thread(
-                parrallel_mcTrial, std::ref(scores), board, player
-        ));
+    //Run the parrallel_mcTrial function n_threads amount of times on the pool
+    TaskGroup trials(mcPool());
+    for (unsigned i = 0; i < n_threads; ++i) {
+        uint64_t seed = uint64_t(threadRng()()) << 32 | i;
+        if (accumulation == Accumulation::PerWorker)
+            trials.submit(parrallel_mcTrial<Scores>, std::ref(workerScores[i].scores), board, player, seed);
+        else
+            trials.submit(parrallel_mcTrial<AtomicScores>, std::ref(atomicScores), board, player, seed);
     }
-    //Join the threads.
-    for (auto &thread : workers) {
-        thread.join();
+    //Wait for the trials to finish.
+    trials.wait();
+
+    //Add up the scores of the workers.
+    for (int i = 0; i < 9; ++i) {
+        if (accumulation == Accumulation::PerWorker)
+            for (unsigned t = 0; t < n_threads; ++t) scores[i] += workerScores[t].scores[i];
+        else
+            scores[i] = atomicScores[i].load(std::memory_order_relaxed);
     }
 
     //Return the best move.
     return getBestMove(scores, board);
 }
 
-int main()
+//UCT search on the same pool, with a budget of milliseconds per move
+Move uctMove(const State &board, std::chrono::milliseconds budget, unsigned &playouts)
+{
+    thread_local UctSearch search;
+    UctLimits limits = { 0, budget };
+    Move m = search.search(toBoard(board), mcPool(), n_threads, limits, uint64_t(threadRng()()) << 32);
+    playouts = search.playouts();
+    return m;
+}
+
+bool parseEngine(const std::string &name, Engine &engine)
+{
+    if (name == "mc") engine = Engine::MonteCarlo;
+    else if (name == "mc-atomic") engine = Engine::MonteCarloAtomic;
+    else if (name == "uct") engine = Engine::Uct;
+    else if (name == "solver") engine = Engine::Solver;
+    else if (name == "random") engine = Engine::Random;
+    else return false;
+    return true;
+}
+
+//The move of engine for the player to move, with the playouts it took
+Move computerMove(Engine engine, const State &board, std::chrono::milliseconds budget, unsigned &playouts)
+{
+    playouts = 0;
+    switch (engine) {
+        case Engine::Uct:
+            return uctMove(board, budget, playouts);
+        case Engine::Solver:
+            return Solver::instance().bestMove(toBoard(board), threadRng());
+        case Engine::Random: {
+            std::vector<Move> moves = getMoves(board);
+            return *select_randomly(moves.begin(), moves.end());
+        }
+        default:
+            playouts = n_trials / n_threads * n_threads;
+            return mcMove(board, getCurrentPlayer(board),
+                          engine == Engine::MonteCarloAtomic ? Accumulation::Atomic : Accumulation::PerWorker);
+    }
+}
+
+struct GameStats {
+    int wins[3];                  //by Player: X, O, draws
+    unsigned long long playouts;
+    std::vector<double> latency;  //seconds of every engine move that played out
+};
+
+//Plays one game between two engines, adding its result to stats
+void playGame(Engine x, Engine o, std::chrono::milliseconds budget, uint64_t seed, GameStats &stats)
+{
+    threadRng().reseed(seed);
+    State board;
+    board.fill(Player::None);
+    while (getMoves(board).size() > 0) {
+        unsigned playouts;
+        const Stopwatch watch;
+        Move m = computerMove(getCurrentPlayer(board) == Player::X ? x : o, board, budget, playouts);
+        const double seconds = watch.seconds();
+        if (playouts > 0) {
+            stats.playouts += playouts;
+            stats.latency.push_back(seconds);
+        }
+        board = doMove(board, m);
+    }
+    stats.wins[int(getWinner(board))]++;
+}
+
+/*
+ Plays games between engines x and o without any input, parallel games at a time on a pool
+ of their own; the engines run their searches on the shared pool as in a normal game. Prints
+ one record of results, throughput and move latency, as CSV (with a header line) or JSON.
+ */
+int selfPlay(int games, Engine x, Engine o, const std::string &xName, const std::string &oName,
+             unsigned parallel, std::chrono::milliseconds budget, bool json)
+{
+    GameStats total = { { 0, 0, 0 }, 0, {} };
+    std::mutex mutex;
+    uint64_t base = threadRng()();
+    const Stopwatch watch;
+    {
+        ThreadPool matches(std::max(1u, parallel));
+        TaskGroup group(matches);
+        for (int g = 0; g < games; ++g) {
+            group.submit([&, g]() {
+                GameStats stats = { { 0, 0, 0 }, 0, {} };
+                playGame(x, o, budget, base + g, stats);
+                std::lock_guard<std::mutex> lock(mutex);
+                for (int i = 0; i < 3; ++i) total.wins[i] += stats.wins[i];
+                total.playouts += stats.playouts;
+                total.latency.insert(total.latency.end(), stats.latency.begin(), stats.latency.end());
+            });
+        }
+        group.wait();
+    }
+    double seconds = watch.seconds();
+
+    auto latency = [&](double p) { return 1000 * percentile(total.latency, p / 100); };
+    double rate = total.playouts / seconds;
+    double perThread = rate / n_threads; //all games search on the same workers
+    if (json) {
+        std::printf("{\"x\": \"%s\", \"o\": \"%s\", \"games\": %d, \"parallel\": %u, \"threads\": %u, "
+                    "\"x_wins\": %.4f, \"o_wins\": %.4f, \"draws\": %.4f, \"seconds\": %.6f, \"playouts\": %llu, "
+                    "\"playouts_per_second\": %.1f, \"playouts_per_thread_second\": %.1f, "
+                    "\"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}\n",
+                    xName.c_str(), oName.c_str(), games, parallel, n_threads,
+                    double(total.wins[0]) / games, double(total.wins[1]) / games, double(total.wins[2]) / games,
+                    seconds, total.playouts, rate, perThread, latency(50), latency(90), latency(99), latency(100));
+    }
+    else {
+        std::printf("x,o,games,parallel,threads,x_wins,o_wins,draws,seconds,playouts,playouts_per_second,"
+                    "playouts_per_thread_second,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms\n");
+        std::printf("%s,%s,%d,%u,%u,%.4f,%.4f,%.4f,%.6f,%llu,%.1f,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+                    xName.c_str(), oName.c_str(), games, parallel, n_threads,
+                    double(total.wins[0]) / games, double(total.wins[1]) / games, double(total.wins[2]) / games,
+                    seconds, total.playouts, rate, perThread, latency(50), latency(90), latency(99), latency(100));
+    }
+    return 0;
+}
+
+//Gomoku, five in a row on 15x15, against flat Monte Carlo with trials playouts a move
+int playGomoku(unsigned trials)
+{
+    using Gomoku = MnkBoard<15,15,5>;
+    Gomoku board;
+    std::cout << board << std::endl;
+    while (!isOver(board)) {
+        Move m;
+        if (getCurrentPlayer(board) == Player::X) {
+            int row, col;
+            do {
+                std::cout << "Enter a move (row and column, 0 to 14): ";
+                if (!(std::cin >> row >> col)) return 1;
+                m = row * Gomoku::cols + col;
+            } while (row < 0 || row >= Gomoku::rows || col < 0 || col >= Gomoku::cols || board.cells[m] != Player::None);
+        }
+        else {
+            m = mnkMcMove(board, mcPool(), n_threads, trials, uint64_t(threadRng()()) << 32);
+        }
+        board = doMove(board, m);
+        std::cout << board << std::endl;
+    }
+
+    Player winner = getWinner(board);
+    if(winner == Player::X) std::cout << "You won!" << std::endl;
+    else if(winner == Player::O) std::cout << "The computer won! " << std::endl;
+    else std::cout << "Draw!" << std::endl;
+    return 0;
+}
+
+/*
+ usage: tttmc [ENGINE [milliseconds per uct move]]
+        tttmc gomoku [playouts per move]
+        tttmc selfplay GAMES X_ENGINE O_ENGINE [games at a time] [milliseconds per uct move] [csv | json]
+ with ENGINE one of mc, mc-atomic, uct, solver or random
+ */
+int main(int argc, char *argv[])
 {
-    std::srand(std::time(0));
+    threadRng().reseed(std::time(0));
+
+    if (argc > 1 && std::string(argv[1]) == "gomoku")
+        return playGomoku(argc > 2 ? std::atoi(argv[2]) : n_trials);
+
+    if (argc > 1 && std::string(argv[1]) == "selfplay") {
+        Engine x, o;
+        int games = argc > 2 ? std::atoi(argv[2]) : 0;
+        if (argc < 5 || games <= 0 || !parseEngine(argv[3], x) || !parseEngine(argv[4], o)) {
+            std::cerr << "usage: tttmc selfplay GAMES X_ENGINE O_ENGINE [parallel] [milliseconds] [csv | json]" << std::endl;
+            return 1;
+        }
+        unsigned parallel = argc > 5 ? std::atoi(argv[5]) : 1;
+        std::chrono::milliseconds budget(argc > 6 ? std::atoi(argv[6]) : 100);
+        bool json = argc > 7 && std::string(argv[7]) == "json";
+        return selfPlay(games, x, o, argv[3], argv[4], parallel, budget, json);
+    }
+
+    Engine engine = Engine::MonteCarlo;
+    if (argc > 1 && !parseEngine(argv[1], engine)) {
+        std::cerr << "unknown engine " << argv[1] << std::endl;
+        return 1;
+    }
+    std::chrono::milliseconds budget(argc > 2 ? std::atoi(argv[2]) : 100);
 
     std::map<Player,PlayerType> playerType;
     playerType[Player::X] = PlayerType::Human;
@@ -146,7 +378,8 @@ int main()
             board = doMove(board, m);
         }
         else {
-            board = doMove(board, mcMove(board, getCurrentPlayer(board)));
+            unsigned playouts;
+            board = doMove(board, computerMove(engine, board, budget, playouts));
         }
         std::cout << board << std::endl;
         moves = getMoves(board);
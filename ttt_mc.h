@@ -5,6 +5,8 @@
 
 #include <tuple>
 #include <array>
+#include <cstdint>
+#include <atomic>
 #include <vector>
 #include <ctime>
 #include <random>
@@ -15,6 +17,129 @@ enum class Player { X, O, None };
 using Move = int;
 using State = std::array<Player,9>;
 
+// Squares as bits: bit i of a mask stands for square i of a State
+using Mask = uint16_t;
+Mask const fullBoard = 0x1ff;
+
+// The rows, columns and diagonals that win the game
+constexpr Mask winLines[8] = { 0x007, 0x038, 0x1c0, 0x049, 0x092, 0x124, 0x111, 0x054 };
+
+// Bitboard form of a State: the squares of X and of O, and who moves next
+struct Board {
+    Mask x, o;
+    Player toMove;
+};
+
+inline int popcount(Mask mask)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    int count = 0;
+    for (; mask; mask &= mask - 1) count++;
+    return count;
+#endif
+}
+
+// The lowest square in a non-empty mask
+inline Move lowestSquare(Mask mask)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    Move m = 0;
+    for (; !(mask >> m & 1); m++);
+    return m;
+#endif
+}
+
+// X moves first, so O is to move whenever X has more pieces
+inline Player sideToMove(Mask x, Mask o)
+{
+    return popcount(x) > popcount(o) ? Player::O : Player::X;
+}
+
+// True when mask holds all three squares of any line
+inline bool hasLine(Mask mask)
+{
+    bool line = false;
+    for (Mask l : winLines) line |= (mask & l) == l;
+    return line;
+}
+
+inline Player getWinner(const Board &board)
+{
+    return hasLine(board.x) ? Player::X : hasLine(board.o) ? Player::O : Player::None;
+}
+
+// The empty squares, or none once the game is won
+inline Mask getMoveMask(const Board &board)
+{
+    Mask over = -Mask(hasLine(board.x) | hasLine(board.o));
+    return ~(board.x | board.o | over) & fullBoard;
+}
+
+inline Board doMove(const Board &board, Move m)
+{
+    Mask bit = Mask(1u << m);
+    Mask toX = -Mask(board.toMove == Player::X);
+    Board result = { Mask(board.x | (bit & toX)), Mask(board.o | (bit & ~toX)),
+                     board.toMove == Player::X ? Player::O : Player::X };
+    return result;
+}
+
+/*
+ xoshiro128** by Blackman and Vigna: a small, fast generator with 128 bits of state.
+ Every thread has its own, so drawing numbers needs no lock and threads never share a
+ cache line for it.
+ */
+class Xoshiro128 {
+public:
+    using result_type = uint32_t;
+    explicit Xoshiro128(uint64_t seed = 0) { reseed(seed); }
+
+    // Fills the state with splitmix64, so any seed, 0 included, gives a good start
+    void reseed(uint64_t seed)
+    {
+        for (int i = 0; i < 4; i += 2) {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z ^= z >> 31;
+            s[i] = uint32_t(z);
+            s[i + 1] = uint32_t(z >> 32);
+        }
+    }
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return UINT32_MAX; }
+    result_type operator()()
+    {
+        uint32_t result = rotl(s[1] * 5, 7) * 9;
+        uint32_t t = s[1] << 9;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 11);
+        return result;
+    }
+    // Uniform in [0, n) for small n, by multiplying instead of dividing
+    uint32_t below(uint32_t n) { return uint32_t((uint64_t((*this)()) * n) >> 32); }
+private:
+    static uint32_t rotl(uint32_t x, int k) { return (x << k) | (x >> (32 - k)); }
+    uint32_t s[4];
+};
+
+// The generator of the calling thread, seeded differently in every thread until reseeded
+inline Xoshiro128 &threadRng()
+{
+    static std::random_device rd;
+    static std::atomic<uint64_t> threads(0);
+    thread_local Xoshiro128 rng((uint64_t(rd()) << 32) ^ threads++);
+    return rng;
+}
+
 // used to get a random element from a container
 template<typename Iter, typename RandomGenerator>
 Iter select_randomly(Iter start, Iter end, RandomGenerator& g) {
@@ -25,11 +150,16 @@ Iter select_randomly(Iter start, Iter end, RandomGenerator& g) {
 
 template<typename Iter>
 Iter select_randomly(Iter start, Iter end) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    return select_randomly(start, end, gen);
+    return select_randomly(start, end, threadRng());
 }
 
+// Plays random moves from board until the game is over, without allocating
+Board playout(Board board, Xoshiro128 &rng);
+
+Board toBoard(const State &state);
+State toState(const Board &board);
+
+// The State functions below are implemented on top of Board
 std::ostream &operator<<(std::ostream &os, const State &state);
 std::ostream &operator<<(std::ostream &os, const Player &player);
 
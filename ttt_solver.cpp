@@ -0,0 +1,118 @@
+// ttt_solver.cpp
+
+#include "ttt_solver.h"
+
+namespace {
+
+const int8_t Unknown = 2;
+const int codes = 19683; // 3^9
+
+// The square that square i moves to under each of the 8 symmetries of the board
+const int symmetries[8][9] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8 }, // identity
+    { 2, 5, 8, 1, 4, 7, 0, 3, 6 }, // quarter turn
+    { 8, 7, 6, 5, 4, 3, 2, 1, 0 }, // half turn
+    { 6, 3, 0, 7, 4, 1, 8, 5, 2 }, // three quarter turn
+    { 2, 1, 0, 5, 4, 3, 8, 7, 6 }, // mirrored left to right
+    { 6, 7, 8, 3, 4, 5, 0, 1, 2 }, // mirrored top to bottom
+    { 0, 3, 6, 1, 4, 7, 2, 5, 8 }, // mirrored in the main diagonal
+    { 8, 5, 2, 7, 4, 1, 6, 3, 0 }  // mirrored in the other diagonal
+};
+
+// Lookup tables over all 512 masks: a mask under every symmetry, and its base 3 weight
+struct Codes {
+    Mask mapped[8][512];
+    int ternary[512];
+
+    Codes()
+    {
+        for (int mask = 0; mask < 512; mask++) {
+            int weight = 0;
+            for (int i = 8; i >= 0; i--) weight = weight * 3 + (mask >> i & 1);
+            ternary[mask] = weight;
+            for (int s = 0; s < 8; s++) {
+                Mask m = 0;
+                for (int i = 0; i < 9; i++) m |= Mask(mask >> i & 1) << symmetries[s][i];
+                mapped[s][mask] = m;
+            }
+        }
+    }
+};
+
+const Codes &lookup()
+{
+    static const Codes tables;
+    return tables;
+}
+
+}
+
+const Solver &Solver::instance()
+{
+    static const Solver solver;
+    return solver;
+}
+
+Solver::Solver(): table(codes, Unknown), stored(0)
+{
+    Board empty = { 0, 0, Player::X };
+    solve(empty);
+}
+
+int Solver::key(const Board &board)
+{
+    const Codes &c = lookup();
+    int best = codes;
+    for (int s = 0; s < 8; s++) {
+        int code = c.ternary[c.mapped[s][board.x]] + 2 * c.ternary[c.mapped[s][board.o]];
+        if (code < best) best = code;
+    }
+    return best;
+}
+
+int Solver::solve(const Board &board)
+{
+    int k = key(board);
+    if (table[k] != Unknown) return table[k];
+
+    int best;
+    Mask free = getMoveMask(board);
+    if (getWinner(board) != Player::None)
+        best = Loss; // the player who just moved made a line
+    else if (free == 0)
+        best = Draw;
+    else {
+        best = Loss;
+        for (; free; free &= free - 1) {
+            int v = -solve(doMove(board, lowestSquare(free)));
+            if (v > best) best = v;
+        }
+    }
+    table[k] = int8_t(best);
+    stored++;
+    return best;
+}
+
+int Solver::value(const Board &board) const
+{
+    int v = table[key(board)];
+    // Positions no game can reach, like both players having a line, are not in the table
+    if (v == Unknown) return getWinner(board) != Player::None ? Loss : Draw;
+    return v;
+}
+
+Move Solver::bestMove(const Board &board, Xoshiro128 &rng) const
+{
+    Move best[9];
+    int count = 0, bestValue = Loss - 1;
+    for (Mask free = getMoveMask(board); free; free &= free - 1) {
+        Move m = lowestSquare(free);
+        int v = -value(doMove(board, m));
+        if (v > bestValue) {
+            bestValue = v;
+            count = 0;
+        }
+        if (v == bestValue) best[count++] = m;
+    }
+    return count > 0 ? best[rng.below(count)] : -1;
+}
@@ -0,0 +1,38 @@
+// ttt_solver.h
+
+#ifndef TTT_SOLVER_H
+#define TTT_SOLVER_H
+
+#include <cstdint>
+#include <vector>
+#include "ttt_mc.h"
+
+/*
+ Transposition table with the exact minimax value of every position that can come up in a
+ game, filled by a full search the first time it is used. The eight rotations and reflections
+ of a position have the same value, so only one of them is stored: the one with the lowest
+ base 3 code (0 empty, 1 X, 2 O per square), which is also its key. With 765 such positions
+ out of 5478, the table is a lookup instead of a search on every move.
+ */
+class Solver {
+public:
+    enum { Loss = -1, Draw = 0, Win = 1 };
+
+    static const Solver &instance(); // solved once, on the first call
+
+    // The value for the player to move: Win, Draw or Loss with perfect play on both sides
+    int value(const Board &board) const;
+    // A random one of the moves that keep the best value, -1 once the game is over
+    Move bestMove(const Board &board, Xoshiro128 &rng) const;
+
+    static int key(const Board &board); // the code of the canonical position
+    size_t positions() const { return stored; }
+private:
+    Solver();
+    int solve(const Board &board);
+
+    std::vector<int8_t> table; // by key, Unknown for positions not searched
+    size_t stored;
+};
+
+#endif // TTT_SOLVER_H
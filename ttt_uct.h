@@ -0,0 +1,189 @@
+// ttt_uct.h
+
+#ifndef TTT_UCT_H
+#define TTT_UCT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include "ttt_mc.h"
+#include "threadpool.h"
+
+// When a search stops: after this many playouts or this much time, whichever comes first.
+// Without either it stops after 15000 playouts, as many as mcMove plays.
+struct UctLimits {
+    int playouts;                   // 0 is no limit
+    std::chrono::milliseconds time; // 0 is no limit
+};
+
+/*
+ Tree-parallel UCT (Monte Carlo tree search with UCB1 selection). All workers descend one
+ shared tree whose nodes come from a pool allocated up front, and update it without locks:
+
+ - on the way down every node on the path gets a visit without a win, a virtual loss, so
+   the workers that follow spread out over other branches instead of all taking the same one;
+ - on the way up the result is added to the wins, which turns the virtual loss into a real
+   visit;
+ - the first worker to reach a leaf that was visited before expands it, the others play out
+   from the leaf meanwhile.
+
+ Once the pool is full the leaves are no longer expanded and the search goes on with
+ playouts from them.
+ */
+class UctSearch {
+public:
+    explicit UctSearch(size_t capacity = 1 << 16, double exploration = 1.4): nodes(capacity), exploration(exploration) { }
+
+    // The most visited move from board, found by threads tasks on the pool
+    Move search(const Board &board, ThreadPool &pool, unsigned threads, const UctLimits &limits, uint64_t seed);
+    int playouts() const { return done.load(); }
+    size_t size() const { return used.load(); } // nodes of the last search
+private:
+    enum { Leaf, Expanding, Expanded };
+
+    struct Node {
+        Board board;              // the position after move
+        Move move;
+        std::atomic<int> visits;  // including the virtual losses of workers below it
+        std::atomic<int> wins;    // two for a win and one for a draw of the player who made move
+        std::atomic<int> state;   // Leaf, Expanding or Expanded
+        int first, count;         // the children, set before state becomes Expanded
+    };
+
+    void reset(Node &node, const Board &board, Move move);
+    int select(const Node &node) const;
+    bool expand(Node &node);
+    void work(const UctLimits &limits, std::chrono::steady_clock::time_point deadline, uint64_t seed);
+
+    std::vector<Node> nodes;
+    std::atomic<size_t> used;
+    std::atomic<int> started; // playouts handed out
+    std::atomic<int> done;
+    const double exploration;
+};
+
+inline void UctSearch::reset(Node &node, const Board &board, Move move)
+{
+    node.board = board;
+    node.move = move;
+    node.visits.store(0, std::memory_order_relaxed);
+    node.wins.store(0, std::memory_order_relaxed);
+    node.state.store(Leaf, std::memory_order_relaxed);
+    node.first = node.count = 0;
+}
+
+// The child with the highest upper confidence bound, an unvisited one before any other
+inline int UctSearch::select(const Node &node) const
+{
+    const double logN = std::log(double(std::max(1, node.visits.load(std::memory_order_relaxed))));
+    int best = node.first;
+    double bestBound = -1;
+    for (int c = node.first; c < node.first + node.count; c++) {
+        int n = nodes[c].visits.load(std::memory_order_relaxed);
+        if (n == 0) return c;
+        double mean = nodes[c].wins.load(std::memory_order_relaxed) / (2.0 * n);
+        double bound = mean + exploration * std::sqrt(logN / n);
+        if (bound > bestBound) {
+            bestBound = bound;
+            best = c;
+        }
+    }
+    return best;
+}
+
+// Gives node its children, false when another worker is at it or the pool is full
+inline bool UctSearch::expand(Node &node)
+{
+    int leaf = Leaf;
+    if (!node.state.compare_exchange_strong(leaf, Expanding, std::memory_order_acquire))
+        return false;
+    Mask free = getMoveMask(node.board);
+    int count = popcount(free);
+    size_t first = used.fetch_add(count, std::memory_order_relaxed);
+    if (first + count > nodes.size()) {
+        used.fetch_sub(count, std::memory_order_relaxed);
+        node.state.store(Leaf, std::memory_order_release);
+        return false;
+    }
+    for (size_t c = first; free; free &= free - 1, c++) {
+        Move m = lowestSquare(free);
+        reset(nodes[c], doMove(node.board, m), m);
+    }
+    node.first = int(first);
+    node.count = count;
+    node.state.store(Expanded, std::memory_order_release);
+    return true;
+}
+
+inline void UctSearch::work(const UctLimits &limits, std::chrono::steady_clock::time_point deadline, uint64_t seed)
+{
+    Xoshiro128 &rng = threadRng();
+    rng.reseed(seed);
+    std::vector<int> path;
+    for (;;) {
+        if (limits.playouts > 0 && started.fetch_add(1, std::memory_order_relaxed) >= limits.playouts)
+            break;
+        if (limits.time.count() > 0 && std::chrono::steady_clock::now() >= deadline)
+            break;
+
+        // Down to a leaf, with a virtual loss on every node on the way
+        path.clear();
+        int current = 0;
+        nodes[0].visits.fetch_add(1, std::memory_order_relaxed);
+        path.push_back(0);
+        while (nodes[current].state.load(std::memory_order_acquire) == Expanded && nodes[current].count > 0) {
+            current = select(nodes[current]);
+            nodes[current].visits.fetch_add(1, std::memory_order_relaxed);
+            path.push_back(current);
+        }
+        Node &leaf = nodes[current];
+        if (leaf.visits.load(std::memory_order_relaxed) > 1 && getMoveMask(leaf.board) != 0 && expand(leaf)) {
+            current = select(leaf);
+            nodes[current].visits.fetch_add(1, std::memory_order_relaxed);
+            path.push_back(current);
+        }
+
+        // Up again, scoring every node for the player who moved into it
+        Player winner = getWinner(playout(nodes[current].board, rng));
+        for (int n : path) {
+            Player mover = nodes[n].board.toMove == Player::X ? Player::O : Player::X;
+            int score = winner == Player::None ? 1 : winner == mover ? 2 : 0;
+            nodes[n].wins.fetch_add(score, std::memory_order_relaxed);
+        }
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline Move UctSearch::search(const Board &board, ThreadPool &pool, unsigned threads, const UctLimits &limits, uint64_t seed)
+{
+    UctLimits bounded = limits;
+    if (bounded.playouts <= 0 && bounded.time.count() <= 0)
+        bounded.playouts = 15000;
+    reset(nodes[0], board, -1);
+    used = 1;
+    started = 0;
+    done = 0;
+    const auto deadline = std::chrono::steady_clock::now() + bounded.time;
+    {
+        TaskGroup group(pool);
+        for (unsigned i = 0; i < threads; i++)
+            group.submit([=]() { work(bounded, deadline, seed + i); });
+        group.wait();
+    }
+
+    Node &root = nodes[0];
+    if (root.state.load() != Expanded) {
+        // Not even one playout got to expand the root
+        Mask free = getMoveMask(board);
+        return free ? lowestSquare(free) : -1;
+    }
+    int best = root.first;
+    for (int c = root.first; c < root.first + root.count; c++)
+        if (nodes[c].visits.load() > nodes[best].visits.load())
+            best = c;
+    return nodes[best].move;
+}
+
+#endif // TTT_UCT_H